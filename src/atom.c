@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "idmap.h"
+#include "atom.h"
+
+#define ATOM_MIN_CAPACITY 64
+
+struct atom_entry {
+  xcb_atom_t atom;
+  uint32_t hash;
+  char name[];
+};
+
+struct atom {
+  xcb_connection_t *c;
+  /// Entries by name. Open addressing with linear probing, NULL marks an
+  /// empty slot. Entries are never removed.
+  struct atom_entry **by_name;
+  /// Number of slots of by_name, always a power of 2
+  unsigned int capacity;
+  unsigned int count;
+  /// Entries by atom
+  idmap_t by_atom;
+};
+
+/// FNV-1a hash of a name
+static uint32_t attr_pure
+atom_hash(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char) name[i]) * 16777619u;
+  return h;
+}
+
+/// Find the slot of a name, or the empty slot it would go into
+static struct atom_entry **
+atom_find_slot(const struct atom *a, const char *name, size_t len,
+    uint32_t hash) {
+  const unsigned int mask = a->capacity - 1;
+  for (unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+    struct atom_entry *e = a->by_name[i];
+    if (!e || (e->hash == hash && !strncmp(e->name, name, len)
+          && !e->name[len]))
+      return &a->by_name[i];
+  }
+}
+
+struct atom *atom_new(xcb_connection_t *c) {
+  auto a = cmalloc(struct atom);
+  a->c = c;
+  a->capacity = ATOM_MIN_CAPACITY;
+  a->count = 0;
+  a->by_name = ccalloc(a->capacity, struct atom_entry *);
+  idmap_init(&a->by_atom);
+  return a;
+}
+
+void atom_free(struct atom *a) {
+  if (!a)
+    return;
+  for (unsigned int i = 0; i < a->capacity; i++)
+    free(a->by_name[i]);
+  free(a->by_name);
+  idmap_deinit(&a->by_atom);
+  free(a);
+}
+
+/// Record a mapping between a name and an atom
+static struct atom_entry *
+atom_add(struct atom *a, const char *name, size_t len, xcb_atom_t atom) {
+  // Keep the load factor under 1/2
+  if ((a->count + 1) * 2 > a->capacity) {
+    struct atom_entry **old = a->by_name;
+    unsigned int old_capacity = a->capacity;
+    a->capacity *= 2;
+    a->by_name = ccalloc(a->capacity, struct atom_entry *);
+    for (unsigned int i = 0; i < old_capacity; i++)
+      if (old[i])
+        *atom_find_slot(a, old[i]->name, strlen(old[i]->name), old[i]->hash) =
+          old[i];
+    free(old);
+  }
+
+  uint32_t hash = atom_hash(name, len);
+  struct atom_entry **slot = atom_find_slot(a, name, len, hash);
+  if (!*slot) {
+    struct atom_entry *e = cvalloc(sizeof(struct atom_entry) + len + 1);
+    e->atom = atom;
+    e->hash = hash;
+    memcpy(e->name, name, len);
+    e->name[len] = '\0';
+    *slot = e;
+    a->count++;
+  }
+  if (atom)
+    idmap_set(&a->by_atom, atom, *slot);
+  return *slot;
+}
+
+static inline const struct atom_entry *
+atom_lookup(const struct atom *a, const char *name) {
+  size_t len = strlen(name);
+  return *atom_find_slot(a, name, len, atom_hash(name, len));
+}
+
+bool atom_intern_many(struct atom *a, const char *const *names, size_t n,
+    xcb_atom_t *atoms) {
+  auto cookies = ccalloc(n, xcb_intern_atom_cookie_t);
+  auto pending = ccalloc(n, bool);
+  bool ret = true;
+
+  for (size_t i = 0; i < n; i++) {
+    const struct atom_entry *e = atom_lookup(a, names[i]);
+    if (e) {
+      if (atoms)
+        atoms[i] = e->atom;
+      continue;
+    }
+    cookies[i] = xcb_intern_atom(a->c, false, strlen(names[i]), names[i]);
+    pending[i] = true;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (!pending[i])
+      continue;
+    xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(a->c, cookies[i], NULL);
+    xcb_atom_t atom = XCB_NONE;
+    if (r) {
+      atom = r->atom;
+      atom_add(a, names[i], strlen(names[i]), atom);
+      free(r);
+    }
+    else
+      ret = false;
+    if (atoms)
+      atoms[i] = atom;
+  }
+
+  free(cookies);
+  free(pending);
+  return ret;
+}
+
+xcb_atom_t atom_get(struct atom *a, const char *name) {
+  xcb_atom_t atom = XCB_NONE;
+  atom_intern_many(a, &name, 1, &atom);
+  return atom;
+}
+
+const char *atom_get_name(struct atom *a, xcb_atom_t atom) {
+  if (!atom)
+    return NULL;
+
+  const struct atom_entry *e = idmap_get(&a->by_atom, atom);
+  if (e)
+    return e->name;
+
+  xcb_get_atom_name_reply_t *r =
+    xcb_get_atom_name_reply(a->c, xcb_get_atom_name(a->c, atom), NULL);
+  if (!r)
+    return NULL;
+  e = atom_add(a, xcb_get_atom_name_name(r),
+      xcb_get_atom_name_name_length(r), atom);
+  free(r);
+  return e->name;
+}
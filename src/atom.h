@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <xcb/xcb.h>
+
+/// A registry of atoms and their names, in both directions.
+///
+/// Every mapping learnt from the X server is kept for the lifetime of the
+/// registry, atoms are never deleted by the server, so the server is asked
+/// about each name or atom at most once.
+struct atom;
+
+struct atom *atom_new(xcb_connection_t *c);
+void atom_free(struct atom *a);
+
+/// Intern a number of names, sending all the requests before waiting for
+/// any of the replies. Names already known are skipped.
+///
+/// @param atoms where to store the atoms of the names, may be NULL
+///
+/// @return whether all names were interned successfully
+bool atom_intern_many(struct atom *a, const char *const *names, size_t n,
+    xcb_atom_t *atoms);
+
+/// Get the atom of a name, interning it if it's not known yet.
+///
+/// @return the atom, XCB_NONE if it can't be interned
+xcb_atom_t atom_get(struct atom *a, const char *name);
+
+/// Get the name of an atom, asking the X server if it's not known yet.
+///
+/// @return the name, owned by the registry. NULL if the atom is invalid.
+const char *atom_get_name(struct atom *a, xcb_atom_t atom);
@@ -36,6 +36,10 @@
 
 #define C2_MAX_LEVELS 10
 
+/// Number of 32-bit units of a property to fetch into the property cache.
+/// Leaves looking past this go to the X server directly.
+#define C2_PROP_CACHE_LENGTH 64
+
 typedef struct _c2_b c2_b_t;
 typedef struct _c2_l c2_l_t;
 
@@ -99,6 +103,8 @@ struct _c2_l {
     C2_L_MPCRE,
   } match     : 3;
   bool match_ignorecase : 1;
+  /// Index of the leaf in the multi-pattern matcher, -1 if not indexed.
+  int ms_id;
   char *tgt;
   Atom tgtatom;
   bool tgt_onframe;
@@ -158,6 +164,7 @@ struct _c2_l {
   .op = C2_L_OEXISTS, \
   .match = C2_L_MEXACT, \
   .match_ignorecase = false, \
+  .ms_id = -1, \
   .tgt = NULL, \
   .tgtatom = 0, \
   .tgt_onframe = false, \
@@ -172,10 +179,74 @@ struct _c2_l {
 
 static const c2_l_t leaf_def = C2_L_INIT;
 
+/// Loads a predefined integer target of a window.
+typedef long (*c2_load_int_t)(session_t *ps, win *w);
+/// Loads a predefined string target of a window, NULL if it's unset.
+typedef const char *(*c2_load_str_t)(session_t *ps, win *w);
+/// Compares an integer target with the pattern of a leaf.
+typedef bool (*c2_cmp_int_t)(long tgt, long ptn);
+/// Matches a string target against the pattern of a leaf.
+typedef bool (*c2_cmp_str_t)(const c2_l_t *pleaf, const char *tgt);
+
+/// An instruction of a compiled condition tree.
+///
+/// The program works on a single boolean accumulator, plus a stack for the
+/// left operands of XOR branches.
+typedef struct {
+  enum {
+    /// Set the accumulator to the result of matching a leaf.
+    C2_I_LEAF,
+    /// Set the accumulator to the result of comparing a predefined integer
+    /// target, with the load and comparison picked at compile time.
+    C2_I_INT,
+    /// Set the accumulator to the result of matching a predefined string
+    /// target, with the load and matcher picked at compile time.
+    C2_I_STR,
+    /// Set the accumulator to false.
+    C2_I_FALSE,
+    /// Jump to target if the accumulator is false.
+    C2_I_JZ,
+    /// Jump to target if the accumulator is true.
+    C2_I_JNZ,
+    /// Negate the accumulator.
+    C2_I_NOT,
+    /// Push the accumulator onto the stack.
+    C2_I_PUSH,
+    /// Pop a value, and XOR it into the accumulator.
+    C2_I_XOR,
+  } op;
+  union {
+    const c2_l_t *leaf;
+    int target;
+  };
+  union {
+    struct {
+      c2_load_int_t load;
+      c2_cmp_int_t cmp;
+    } i;
+    struct {
+      c2_load_str_t load;
+      c2_cmp_str_t cmp;
+    } s;
+  };
+} c2_insn_t;
+
+/// A condition tree compiled into a flat program.
+typedef struct {
+  c2_insn_t *insns;
+  int len;
+  /// Maximum depth of the stack while running the program.
+  int depth;
+} c2_prog_t;
+
 /// Linked list type of conditions.
 struct _c2_lptr {
   c2_ptr_t ptr;
   void *data;
+  /// Mask of C2_DEP_* of window data the condition depends on.
+  uint32_t deps;
+  /// The condition tree compiled for matching.
+  c2_prog_t prog;
   struct _c2_lptr *next;
 };
 
@@ -183,9 +254,87 @@ struct _c2_lptr {
 #define C2_LPTR_INIT { \
   .ptr = C2_PTR_INIT, \
   .data = NULL, \
+  .deps = 0, \
+  .prog = { .insns = NULL, .len = 0, .depth = 0 }, \
   .next = NULL, \
 }
 
+/// A window property cached for matching raw property targets.
+struct c2_prop {
+  Window wid;
+  Atom atom;
+  /// Reply of the property request. NULL if the request failed.
+  xcb_get_property_reply_t *r;
+  struct c2_prop *next;
+};
+
+/// Fields of a window matched by the multi-pattern matcher.
+enum {
+  C2_MS_NAME,
+  C2_MS_CLASSI,
+  C2_MS_CLASSG,
+  C2_MS_ROLE,
+  C2_MS_WINTYPE,
+  C2_MS_NUM,
+};
+
+/// A node of an Aho-Corasick automaton.
+typedef struct {
+  /// Characters of edges to child nodes.
+  unsigned char *chars;
+  /// Child nodes, in the same order as chars.
+  int *children;
+  int nchildren;
+  /// Longest proper suffix of this node that is also in the trie.
+  int fail;
+  /// Nearest node along the fail links with patterns ending there, 0 if
+  /// there is none.
+  int dict;
+  /// Leaves with patterns ending at this node.
+  int *out;
+  int nout;
+} c2_ac_node_t;
+
+/// Matcher of all indexed patterns of a field with the same case
+/// sensitivity.
+typedef struct {
+  /// Hash set of exact patterns, open addressing with linear probing.
+  struct c2_ms_exact {
+    /// Pattern, case folded if needed. NULL for an empty slot.
+    char *key;
+    uint32_t hash;
+    int *ids;
+    int nids;
+  } *exact;
+  /// Number of slots of exact, always 0 or a power of 2.
+  unsigned int exact_cap;
+  unsigned int nexact;
+  /// Automaton of prefix and substring patterns, node 0 is the root.
+  c2_ac_node_t *nodes;
+  int nnodes;
+} c2_ms_matcher_t;
+
+/// Multi-pattern matcher of string conditions in all condition lists.
+struct c2_ms {
+  /// Indexed leaves.
+  const c2_l_t **leaves;
+  /// Pattern lengths of indexed leaves.
+  int *lens;
+  int nleaves;
+  /// Matchers, by field and case insensitivity.
+  c2_ms_matcher_t matchers[C2_MS_NUM][2];
+};
+
+/// Results of the multi-pattern matcher for a window.
+struct c2_ms_result {
+  /// Mask of fields the results are valid for.
+  unsigned int valid;
+  /// Strings the results of each field were computed from.
+  const char *src[C2_MS_NUM];
+  /// Result of each indexed leaf.
+  uint8_t bits[];
+};
+
 /// Structure representing a predefined target.
 typedef struct {
   const char *name;
@@ -354,8 +503,14 @@ c2_dump(c2_ptr_t p) {
 static Atom
 c2_get_atom_type(const c2_l_t *pleaf);
 
+static void
+c2_compile(c2_prog_t *prog, const c2_ptr_t p);
+
 static bool
-c2_match_once(session_t *ps, win *w, const c2_ptr_t cond);
+c2_exec(session_t *ps, win *w, const c2_prog_t *prog);
+
+static uint32_t
+c2_get_deps(const c2_ptr_t p);
 
 /**
  * Parse a condition string.
@@ -390,6 +545,8 @@ c2_parse(session_t *ps, c2_lptr_t **pcondlst, const char *pattern,
     memcpy(plptr, &lptr_def, sizeof(c2_lptr_t));
     plptr->ptr = result;
     plptr->data = data;
+    plptr->deps = c2_get_deps(result);
+    c2_compile(&plptr->prog, result);
     if (pcondlst) {
       plptr->next = *pcondlst;
       *pcondlst = plptr;
@@ -1068,6 +1225,22 @@ c2_parse_legacy(session_t *ps, const char *pattern, int offset, c2_ptr_t *presul
   printf_err(format, ## __VA_ARGS__); \
   return false; }
 
+/**
+ * Add an atom to an atom linked list, if it's not there yet.
+ */
+static void
+c2h_latom_add(latom_t **plst, Atom atom) {
+  for (latom_t *platom = *plst; platom; platom = platom->next) {
+    if (atom == platom->atom)
+      return;
+  }
+
+  auto pnew = cmalloc(latom_t);
+  pnew->next = *plst;
+  pnew->atom = atom;
+  *plst = pnew;
+}
+
 /**
  * Do postprocessing on a condition leaf.
  */
@@ -1088,22 +1261,11 @@ c2_l_postprocess(session_t *ps, c2_l_t *pleaf) {
 
   // Insert target Atom into atom track list
   if (pleaf->tgtatom) {
-    bool found = false;
-    for (latom_t *platom = ps->track_atom_lst; platom;
-        platom = platom->next) {
-      if (pleaf->tgtatom == platom->atom) {
-        found = true;
-        break;
-      }
-    }
-    if (!found) {
-      auto pnew = cmalloc(latom_t);
-      if (!pnew)
-        printf_errfq(1, "(): Failed to allocate memory for new track atom.");
-      pnew->next = ps->track_atom_lst;
-      pnew->atom = pleaf->tgtatom;
-      ps->track_atom_lst = pnew;
-    }
+    c2h_latom_add(&ps->track_atom_lst, pleaf->tgtatom);
+    // String properties are fetched with Xlib, the others are served from
+    // the property cache
+    if (C2_L_TSTRING != pleaf->type)
+      c2h_latom_add(&ps->prop_atom_lst, pleaf->tgtatom);
   }
 
   // Enable specific tracking options in compton if needed by the condition
@@ -1209,6 +1371,7 @@ c2_free_lptr(c2_lptr_t *lp) {
 
   c2_lptr_t *pnext = lp->next;
   c2_free(lp->ptr);
+  free(lp->prog.insns);
   free(lp);
 
   return pnext;
@@ -1336,6 +1499,56 @@ c2_dump_raw(c2_ptr_t p) {
   }
 }
 
+/**
+ * Get the mask of window data a condition tree depends on.
+ */
+static uint32_t
+c2_get_deps(const c2_ptr_t p) {
+  if (p.isbranch) {
+    if (!p.b)
+      return 0;
+    return c2_get_deps(p.b->opr1) | c2_get_deps(p.b->opr2);
+  }
+
+  const c2_l_t * const pleaf = p.l;
+  if (!pleaf)
+    return 0;
+
+  switch (pleaf->predef) {
+    case C2_L_PUNDEFINED:
+      // The property may be read from the client window
+      return C2_DEP_ATOM(pleaf->tgtatom) | C2_DEP_CLIENT;
+    case C2_L_PID:
+    case C2_L_PWMWIN:
+    case C2_L_PCLIENT:      return C2_DEP_CLIENT;
+    case C2_L_PX:
+    case C2_L_PY:
+    case C2_L_PX2:
+    case C2_L_PY2:
+    case C2_L_PWIDTH:
+    case C2_L_PHEIGHT:
+    case C2_L_PWIDTHB:
+    case C2_L_PHEIGHTB:
+    case C2_L_PBDW:         return C2_DEP_GEOMETRY;
+    // win_is_fullscreen() also checks whether the window is shaped
+    case C2_L_PFULLSCREEN:
+      return C2_DEP_GEOMETRY | C2_DEP_SHAPE | C2_DEP_FULLSCREEN;
+    case C2_L_POVREDIR:
+    case C2_L_PARGB:        return C2_DEP_ATTR;
+    case C2_L_PFOCUSED:     return C2_DEP_FOCUS;
+    case C2_L_PBSHAPED:
+    case C2_L_PROUNDED:     return C2_DEP_SHAPE;
+    case C2_L_PWINDOWTYPE:  return C2_DEP_WINTYPE;
+    case C2_L_PLEADER:      return C2_DEP_LEADER;
+    case C2_L_PNAME:        return C2_DEP_NAME;
+    case C2_L_PCLASSG:
+    case C2_L_PCLASSI:      return C2_DEP_CLASS;
+    case C2_L_PROLE:        return C2_DEP_ROLE;
+  }
+
+  return C2_DEP_ALL;
+}
+
 /**
  * Get the type atom of a condition.
  */
@@ -1361,6 +1574,533 @@ c2_get_atom_type(const c2_l_t *pleaf) {
   return AnyPropertyType;
 }
 
+/**
+ * Create a cache entry from a property reply.
+ */
+static void
+c2_prop_cache_insert(win *w, Window wid, Atom atom,
+    xcb_get_property_reply_t *r) {
+  auto pnew = cmalloc(struct c2_prop);
+  pnew->wid = wid;
+  pnew->atom = atom;
+  pnew->r = r;
+  pnew->next = w->prop_cache;
+  w->prop_cache = pnew;
+}
+
+/**
+ * Get a property of a window for a raw property target, through the
+ * property cache of the window.
+ *
+ * Behaves like <code>wid_get_prop_adv(ps, wid, pleaf->tgtatom, idx, 1L,
+ * type, pleaf->format)</code>. The returned structure may point into the
+ * cache, it's only valid until the cache is changed, and must still be
+ * freed with free_winprop().
+ */
+static winprop_t
+c2_get_prop(session_t *ps, win *w, Window wid, const c2_l_t *pleaf, int idx) {
+  const Atom rtype = c2_get_atom_type(pleaf);
+  const struct c2_prop *pprop = w->prop_cache;
+  for (; pprop; pprop = pprop->next)
+    if (pprop->wid == wid && pprop->atom == pleaf->tgtatom)
+      break;
+
+  if (!pprop) {
+    xcb_get_property_reply_t *r = xcb_get_property_reply(ps->c,
+        xcb_get_property(ps->c, 0, wid, pleaf->tgtatom, XCB_ATOM_ANY, 0,
+          C2_PROP_CACHE_LENGTH), NULL);
+    c2_prop_cache_insert(w, wid, pleaf->tgtatom, r);
+    pprop = w->prop_cache;
+  }
+
+  const xcb_get_property_reply_t *r = pprop->r;
+  // The offset is counted in 32-bit units by the protocol, whatever the
+  // format of the property
+  const int offset = idx * 4;
+  if (r && r->type == rtype && (!pleaf->format || r->format == pleaf->format)
+      && (r->format == 8 || r->format == 16 || r->format == 32)) {
+    int len = xcb_get_property_value_length(r);
+    if (offset < len) {
+      return (winprop_t) {
+        .ptr = (char *) xcb_get_property_value(r) + offset,
+        .nitems = (len - offset) / (r->format / 8),
+        .type = r->type,
+        .format = r->format,
+        .r = NULL,
+      };
+    }
+    // Only part of the property was fetched
+    if (r->bytes_after)
+      return wid_get_prop_adv(ps, wid, pleaf->tgtatom, idx, 1L, rtype,
+          pleaf->format);
+  }
+
+  return (winprop_t) {
+    .ptr = NULL,
+    .nitems = 0,
+    .type = AnyPropertyType,
+    .format = 0
+  };
+}
+
+/**
+ * Drop a property from the property cache of a window, so the next match
+ * fetches it again.
+ */
+void
+c2_prop_cache_invalidate(win *w, Window wid, Atom atom) {
+  for (struct c2_prop **pp = &w->prop_cache; *pp; pp = &(*pp)->next) {
+    struct c2_prop *pprop = *pp;
+    if (pprop->wid == wid && pprop->atom == atom) {
+      *pp = pprop->next;
+      free(pprop->r);
+      free(pprop);
+      return;
+    }
+  }
+}
+
+/**
+ * Free the property cache of a window.
+ */
+void
+c2_prop_cache_free(win *w) {
+  struct c2_prop *next = NULL;
+  for (struct c2_prop *pprop = w->prop_cache; pprop; pprop = next) {
+    next = pprop->next;
+    free(pprop->r);
+    free(pprop);
+  }
+  w->prop_cache = NULL;
+}
+
+/**
+ * Refill the property cache of a window with all raw properties referenced
+ * by rules, on both the frame and the client window.
+ *
+ * All requests are sent before waiting for any reply.
+ */
+void
+c2_prop_cache_prefetch(session_t *ps, win *w) {
+  c2_prop_cache_free(w);
+
+  const Window wids[] = { w->id, w->client_win };
+  const int nwids = (w->client_win && w->client_win != w->id) ? 2: 1;
+
+  int natoms = 0;
+  for (latom_t *platom = ps->prop_atom_lst; platom; platom = platom->next)
+    ++natoms;
+  if (!natoms)
+    return;
+
+  auto cookies = ccalloc(natoms * nwids, xcb_get_property_cookie_t);
+  int i = 0;
+  for (latom_t *platom = ps->prop_atom_lst; platom; platom = platom->next)
+    for (int j = 0; j < nwids; ++j)
+      cookies[i++] = xcb_get_property(ps->c, 0, wids[j], platom->atom,
+          XCB_ATOM_ANY, 0, C2_PROP_CACHE_LENGTH);
+
+  i = 0;
+  for (latom_t *platom = ps->prop_atom_lst; platom; platom = platom->next)
+    for (int j = 0; j < nwids; ++j)
+      c2_prop_cache_insert(w, wids[j], platom->atom,
+          xcb_get_property_reply(ps->c, cookies[i++], NULL));
+
+  free(cookies);
+}
+
+/**
+ * Map a predefined string target to a field of the multi-pattern matcher.
+ *
+ * @return the field, or -1 if the target is not indexed
+ */
+static inline int
+c2_ms_field(const c2_l_t *pleaf) {
+  switch (pleaf->predef) {
+    case C2_L_PNAME:        return C2_MS_NAME;
+    case C2_L_PCLASSI:      return C2_MS_CLASSI;
+    case C2_L_PCLASSG:      return C2_MS_CLASSG;
+    case C2_L_PROLE:        return C2_MS_ROLE;
+    case C2_L_PWINDOWTYPE:  return C2_MS_WINTYPE;
+    default:                return -1;
+  }
+}
+
+/**
+ * Get the value of a field of the multi-pattern matcher of a window.
+ */
+static inline const char *
+c2_ms_field_str(const win *w, int field) {
+  switch (field) {
+    case C2_MS_NAME:    return w->name;
+    case C2_MS_CLASSI:  return w->class_instance;
+    case C2_MS_CLASSG:  return w->class_general;
+    case C2_MS_ROLE:    return w->role;
+    case C2_MS_WINTYPE: return WINTYPES[w->window_type];
+  }
+  assert(0);
+  return NULL;
+}
+
+static inline unsigned char
+c2_ms_fold(unsigned char c, bool ignorecase) {
+  return ignorecase ? tolower(c): c;
+}
+
+/**
+ * FNV-1a hash of a string, case folded if needed.
+ */
+static uint32_t attr_pure
+c2_ms_hash(const char *str, bool ignorecase) {
+  uint32_t hash = 2166136261u;
+  for (; *str; ++str)
+    hash = (hash ^ c2_ms_fold(*str, ignorecase)) * 16777619u;
+  return hash;
+}
+
+/**
+ * Compare a folded key with a string.
+ */
+static bool attr_pure
+c2_ms_streq(const char *key, const char *str, bool ignorecase) {
+  for (; *key && *str; ++key, ++str)
+    if ((unsigned char) *key != c2_ms_fold(*str, ignorecase))
+      return false;
+  return !*key && !*str;
+}
+
+/**
+ * Find the slot of a string in the exact match hash set of a matcher.
+ *
+ * @return the slot with the string, or the empty slot it would go into
+ */
+static struct c2_ms_exact *
+c2_ms_exact_find(const c2_ms_matcher_t *m, const char *str, uint32_t hash,
+    bool ignorecase) {
+  const unsigned int mask = m->exact_cap - 1;
+  for (unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+    struct c2_ms_exact *e = &m->exact[i];
+    if (!e->key || (e->hash == hash && c2_ms_streq(e->key, str, ignorecase)))
+      return e;
+  }
+}
+
+/**
+ * Find the child of an automaton node on a character.
+ *
+ * @return index of the child node, 0 if there is none
+ */
+static inline int
+c2_ac_child(const c2_ac_node_t *node, unsigned char c) {
+  for (int i = 0; i < node->nchildren; ++i)
+    if (node->chars[i] == c)
+      return node->children[i];
+  return 0;
+}
+
+static void
+c2_ms_add_id(int **pids, int *pnids, int id) {
+  *pids = crealloc(*pids, *pnids + 1);
+  (*pids)[(*pnids)++] = id;
+}
+
+/**
+ * Add a leaf to a matcher.
+ */
+static void
+c2_ms_matcher_add(c2_ms_matcher_t *m, const c2_l_t *pleaf, int id) {
+  const bool ignorecase = pleaf->match_ignorecase;
+
+  if (C2_L_MEXACT == pleaf->match) {
+    // Grow the hash set when it gets half full
+    if ((m->nexact + 1) * 2 > m->exact_cap) {
+      c2_ms_matcher_t old = *m;
+      m->exact_cap = old.exact_cap ? old.exact_cap * 2: 16;
+      m->exact = ccalloc(m->exact_cap, struct c2_ms_exact);
+      for (unsigned int i = 0; i < old.exact_cap; ++i)
+        if (old.exact[i].key)
+          *c2_ms_exact_find(m, old.exact[i].key, old.exact[i].hash, false) =
+            old.exact[i];
+      free(old.exact);
+    }
+
+    uint32_t hash = c2_ms_hash(pleaf->ptnstr, ignorecase);
+    struct c2_ms_exact *e = c2_ms_exact_find(m, pleaf->ptnstr, hash, ignorecase);
+    if (!e->key) {
+      e->key = strdup(pleaf->ptnstr);
+      for (char *pc = e->key; *pc; ++pc)
+        *pc = c2_ms_fold(*pc, ignorecase);
+      e->hash = hash;
+      ++m->nexact;
+    }
+    c2_ms_add_id(&e->ids, &e->nids, id);
+    return;
+  }
+
+  // Prefix and substring patterns go into the automaton
+  if (!m->nnodes) {
+    m->nodes = ccalloc(1, c2_ac_node_t);
+    m->nnodes = 1;
+  }
+  int state = 0;
+  for (const char *pc = pleaf->ptnstr; *pc; ++pc) {
+    unsigned char c = c2_ms_fold(*pc, ignorecase);
+    int next = c2_ac_child(&m->nodes[state], c);
+    if (!next) {
+      next = m->nnodes++;
+      m->nodes = crealloc(m->nodes, m->nnodes);
+      m->nodes[next] = (c2_ac_node_t) { .fail = 0, .dict = 0 };
+
+      c2_ac_node_t *node = &m->nodes[state];
+      node->chars = crealloc(node->chars, node->nchildren + 1);
+      node->children = crealloc(node->children, node->nchildren + 1);
+      node->chars[node->nchildren] = c;
+      node->children[node->nchildren++] = next;
+    }
+    state = next;
+  }
+  c2_ms_add_id(&m->nodes[state].out, &m->nodes[state].nout, id);
+}
+
+/**
+ * Fill in the fail and dictionary links of an automaton, in BFS order.
+ */
+static void
+c2_ms_matcher_link(c2_ms_matcher_t *m) {
+  if (!m->nnodes)
+    return;
+
+  auto queue = ccalloc(m->nnodes, int);
+  int head = 0, tail = 0;
+  for (int i = 0; i < m->nodes[0].nchildren; ++i)
+    queue[tail++] = m->nodes[0].children[i];
+
+  while (head < tail) {
+    int state = queue[head++];
+    const c2_ac_node_t *node = &m->nodes[state];
+    for (int i = 0; i < node->nchildren; ++i) {
+      int child = node->children[i];
+      int f = node->fail;
+      while (f && !c2_ac_child(&m->nodes[f], node->chars[i]))
+        f = m->nodes[f].fail;
+      f = c2_ac_child(&m->nodes[f], node->chars[i]);
+      m->nodes[child].fail = f;
+      // The root is never a dictionary link, its patterns are empty, and
+      // are handled once before scanning
+      m->nodes[child].dict = m->nodes[f].nout ? f: m->nodes[f].dict;
+      queue[tail++] = child;
+    }
+  }
+
+  free(queue);
+}
+
+static void
+c2_ms_matcher_free(c2_ms_matcher_t *m) {
+  for (unsigned int i = 0; i < m->exact_cap; ++i) {
+    free(m->exact[i].key);
+    free(m->exact[i].ids);
+  }
+  free(m->exact);
+  for (int i = 0; i < m->nnodes; ++i) {
+    free(m->nodes[i].chars);
+    free(m->nodes[i].children);
+    free(m->nodes[i].out);
+  }
+  free(m->nodes);
+}
+
+/**
+ * Set the result bit of all indexed leaves in a list matching a string.
+ */
+static inline void
+c2_ms_set_ids(const struct c2_ms *ms, uint8_t *bits, const int *ids, int nids,
+    int end) {
+  for (int i = 0; i < nids; ++i) {
+    const int id = ids[i];
+    // A prefix pattern only matches if it ends where its length says
+    if (end >= 0 && C2_L_MSTART == ms->leaves[id]->match
+        && end + 1 != ms->lens[id])
+      continue;
+    bits[id / 8] |= 1 << (id % 8);
+  }
+}
+
+/**
+ * Run a matcher on a string, and set the result bits of matched leaves.
+ */
+static void
+c2_ms_matcher_run(const struct c2_ms *ms, const c2_ms_matcher_t *m,
+    uint8_t *bits, const char *str, bool ignorecase) {
+  if (m->exact_cap) {
+    const struct c2_ms_exact *e =
+      c2_ms_exact_find(m, str, c2_ms_hash(str, ignorecase), ignorecase);
+    if (e->key)
+      c2_ms_set_ids(ms, bits, e->ids, e->nids, -1);
+  }
+
+  if (!m->nnodes)
+    return;
+
+  // Empty patterns match anything
+  c2_ms_set_ids(ms, bits, m->nodes[0].out, m->nodes[0].nout, -1);
+
+  int state = 0;
+  for (int i = 0; str[i]; ++i) {
+    unsigned char c = c2_ms_fold(str[i], ignorecase);
+    int next;
+    while (!(next = c2_ac_child(&m->nodes[state], c)) && state)
+      state = m->nodes[state].fail;
+    state = next;
+
+    for (int s = m->nodes[state].nout ? state: m->nodes[state].dict; s;
+        s = m->nodes[s].dict)
+      c2_ms_set_ids(ms, bits, m->nodes[s].out, m->nodes[s].nout, i);
+  }
+}
+
+/**
+ * Index all leaves of a condition tree that can be handled by the
+ * multi-pattern matcher.
+ */
+static void
+c2_ms_index(struct c2_ms *ms, c2_ptr_t p) {
+  if (p.isbranch) {
+    if (p.b) {
+      c2_ms_index(ms, p.b->opr1);
+      c2_ms_index(ms, p.b->opr2);
+    }
+    return;
+  }
+
+  c2_l_t *pleaf = p.l;
+  if (!pleaf || C2_L_PTSTRING != pleaf->ptntype || C2_L_OEQ != pleaf->op
+      || c2_ms_field(pleaf) < 0
+      || (C2_L_MEXACT != pleaf->match && C2_L_MSTART != pleaf->match
+        && C2_L_MCONTAINS != pleaf->match))
+    return;
+
+  const int id = ms->nleaves++;
+  ms->leaves = crealloc(ms->leaves, ms->nleaves);
+  ms->lens = crealloc(ms->lens, ms->nleaves);
+  ms->leaves[id] = pleaf;
+  ms->lens[id] = strlen(pleaf->ptnstr);
+  pleaf->ms_id = id;
+  c2_ms_matcher_add(&ms->matchers[c2_ms_field(pleaf)][pleaf->match_ignorecase],
+      pleaf, id);
+}
+
+/**
+ * Build the multi-pattern matcher over string conditions of all condition
+ * lists. Must be called after all conditions are parsed.
+ *
+ * Conditions matching the name, class, role or window type of a window
+ * with an exact, prefix or substring pattern are gathered per field, into a
+ * hash set for exact patterns and an Aho-Corasick automaton for the others.
+ * All of them are then matched with one pass over the field.
+ */
+void
+c2_ms_build(session_t *ps) {
+  const c2_lptr_t * const lsts[] = {
+    ps->o.shadow_blacklist, ps->o.fade_blacklist, ps->o.focus_blacklist,
+    ps->o.invert_color_list, ps->o.blur_background_blacklist,
+    ps->o.opacity_rules, ps->o.paint_blacklist,
+    ps->o.unredir_if_possible_blacklist,
+  };
+
+  auto ms = ccalloc(1, struct c2_ms);
+  for (size_t i = 0; i < ARR_SIZE(lsts); ++i)
+    for (const c2_lptr_t *p = lsts[i]; p; p = p->next)
+      c2_ms_index(ms, p->ptr);
+
+  if (!ms->nleaves) {
+    free(ms);
+    return;
+  }
+
+  for (int i = 0; i < C2_MS_NUM; ++i)
+    for (int j = 0; j < 2; ++j)
+      c2_ms_matcher_link(&ms->matchers[i][j]);
+  ps->c2_ms = ms;
+}
+
+/**
+ * Free the multi-pattern matcher.
+ */
+void
+c2_ms_free(session_t *ps) {
+  struct c2_ms *ms = ps->c2_ms;
+  if (!ms)
+    return;
+
+  for (int i = 0; i < C2_MS_NUM; ++i)
+    for (int j = 0; j < 2; ++j)
+      c2_ms_matcher_free(&ms->matchers[i][j]);
+  free(ms->leaves);
+  free(ms->lens);
+  free(ms);
+  ps->c2_ms = NULL;
+}
+
+/**
+ * Get the result of an indexed leaf for a window, running the matchers for
+ * the field of the leaf if they haven't been run since the field changed.
+ */
+static bool
+c2_ms_match(session_t *ps, win *w, const c2_l_t *pleaf, const char *str) {
+  const struct c2_ms *ms = ps->c2_ms;
+  const int field = c2_ms_field(pleaf);
+  const int nbytes = (ms->nleaves + 7) / 8;
+
+  if (!w->ms_result) {
+    w->ms_result = cvalloc(sizeof(struct c2_ms_result) + nbytes);
+    w->ms_result->valid = 0;
+  }
+  struct c2_ms_result *res = w->ms_result;
+
+  if (!(res->valid & (1u << field)) || res->src[field] != str) {
+    // Clear the bits of this field only
+    for (int i = 0; i < ms->nleaves; ++i)
+      if (c2_ms_field(ms->leaves[i]) == field)
+        res->bits[i / 8] &= ~(1 << (i % 8));
+    c2_ms_matcher_run(ms, &ms->matchers[field][0], res->bits, str, false);
+    c2_ms_matcher_run(ms, &ms->matchers[field][1], res->bits, str, true);
+    res->src[field] = str;
+    res->valid |= 1u << field;
+  }
+
+  return res->bits[pleaf->ms_id / 8] & (1 << (pleaf->ms_id % 8));
+}
+
+/**
+ * Drop multi-pattern match results of a window that depend on changed
+ * window data.
+ *
+ * @param changed mask of C2_DEP_* of the window data that changed
+ */
+void
+c2_ms_result_invalidate(win *w, uint32_t changed) {
+  if (!w->ms_result)
+    return;
+  if (changed & C2_DEP_NAME)
+    w->ms_result->valid &= ~(1u << C2_MS_NAME);
+  if (changed & C2_DEP_CLASS)
+    w->ms_result->valid &= ~(1u << C2_MS_CLASSI | 1u << C2_MS_CLASSG);
+  if (changed & C2_DEP_ROLE)
+    w->ms_result->valid &= ~(1u << C2_MS_ROLE);
+  if (changed & C2_DEP_WINTYPE)
+    w->ms_result->valid &= ~(1u << C2_MS_WINTYPE);
+}
+
+/**
+ * Free the multi-pattern match results of a window.
+ */
+void
+c2_ms_result_free(win *w) {
+  free(w->ms_result);
+  w->ms_result = NULL;
+}
+
 /**
  * Match a window against a single leaf window condition.
  *
@@ -1414,8 +2154,7 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
         }
         // A raw window property
         else {
-          winprop_t prop = wid_get_prop_adv(ps, wid, pleaf->tgtatom,
-              idx, 1L, c2_get_atom_type(pleaf), pleaf->format);
+          winprop_t prop = c2_get_prop(ps, w, wid, pleaf, idx);
           if (prop.nitems) {
             *perr = false;
             tgt = winprop_get_int(prop);
@@ -1460,21 +2199,8 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
         }
         // If it's an atom type property, convert atom to string
         else if (C2_L_TATOM == pleaf->type) {
-          winprop_t prop = wid_get_prop_adv(ps, wid, pleaf->tgtatom,
-              idx, 1L, c2_get_atom_type(pleaf), pleaf->format);
-          Atom atom = winprop_get_int(prop);
-          if (atom) {
-            xcb_get_atom_name_reply_t *reply =
-              xcb_get_atom_name_reply(ps->c, xcb_get_atom_name(ps->c, atom), NULL);
-            if (reply) {
-              tgt_free = strndup(
-                  xcb_get_atom_name_name(reply), xcb_get_atom_name_name_length(reply));
-              free(reply);
-            }
-          }
-          if (tgt_free) {
-            tgt = tgt_free;
-          }
+          winprop_t prop = c2_get_prop(ps, w, wid, pleaf, idx);
+          tgt = get_atom_name(ps, winprop_get_int(prop));
           free_winprop(&prop);
         }
         // Otherwise, just fetch the string list
@@ -1497,6 +2223,14 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
           return;
         }
 
+        // Indexed predefined targets are matched together with all other
+        // patterns on the same field
+        if (pleaf->ms_id >= 0 && ps->c2_ms) {
+          assert(!tgt_free);
+          *pres = c2_ms_match(ps, w, pleaf, tgt);
+          break;
+        }
+
         // Actual matching
         switch (pleaf->op) {
           case C2_L_OEXISTS:
@@ -1564,78 +2298,352 @@ c2_match_once_leaf(session_t *ps, win *w, const c2_l_t *pleaf,
 }
 
 /**
- * Match a window against a single window condition.
+ * Match a window against a single leaf condition, applying negation.
  *
  * @return true if matched, false otherwise.
  */
 static bool
-c2_match_once(session_t *ps, win *w, const c2_ptr_t cond) {
+c2_match_leaf(session_t *ps, win *w, const c2_l_t *pleaf) {
   bool result = false;
   bool error = true;
 
-  // Handle a branch
-  if (cond.isbranch) {
-    const c2_b_t *pb = cond.b;
-
-    if (!pb)
-      return false;
+  c2_match_once_leaf(ps, w, pleaf, &result, &error);
 
+  // For EXISTS operator, no errors are fatal
+  if (C2_L_OEXISTS == pleaf->op && error) {
+    result = false;
     error = false;
-
-    switch (pb->op) {
-      case C2_B_OAND:
-        result = (c2_match_once(ps, w, pb->opr1)
-            && c2_match_once(ps, w, pb->opr2));
-        break;
-      case C2_B_OOR:
-        result = (c2_match_once(ps, w, pb->opr1)
-            || c2_match_once(ps, w, pb->opr2));
-        break;
-      case C2_B_OXOR:
-        result = (c2_match_once(ps, w, pb->opr1)
-            != c2_match_once(ps, w, pb->opr2));
-        break;
-      default:
-        error = true;
-        assert(0);
-    }
+  }
 
 #ifdef DEBUG_WINMATCH
-    printf_dbgf("(%#010lx): branch: result = %d, pattern = ", w->id, result);
-    c2_dump(cond);
+  printf_dbgf("(%#010lx): leaf: result = %d, error = %d, "
+      "client = %#010lx,  pattern = ",
+      w->id, result, error, w->client_win);
+  c2_dump((c2_ptr_t) { .isbranch = false, .l = (c2_l_t *) pleaf });
 #endif
+
+  // Postprocess the result
+  if (error)
+    result = false;
+
+  if (pleaf->neg)
+    result = !result;
+
+  return result;
+}
+
+/** @name Compiled leaves
+ * Loads and comparisons of predefined targets, picked when a leaf is
+ * compiled so matching it doesn't dispatch on the leaf again.
+ */
+///@{
+#define C2_LOAD_INT(name, expr) \
+  static long c2_load_ ## name(session_t *ps, win *w) { return (expr); }
+
+C2_LOAD_INT(id, w->id)
+C2_LOAD_INT(x, w->g.x)
+C2_LOAD_INT(y, w->g.y)
+C2_LOAD_INT(x2, w->g.x + w->widthb)
+C2_LOAD_INT(y2, w->g.y + w->heightb)
+C2_LOAD_INT(width, w->g.width)
+C2_LOAD_INT(height, w->g.height)
+C2_LOAD_INT(widthb, w->widthb)
+C2_LOAD_INT(heightb, w->heightb)
+C2_LOAD_INT(bdw, w->g.border_width)
+C2_LOAD_INT(fullscreen, win_is_fullscreen(ps, w))
+C2_LOAD_INT(overredir, w->a.override_redirect)
+C2_LOAD_INT(argb, win_has_alpha(w))
+C2_LOAD_INT(focused, win_is_focused_real(ps, w))
+C2_LOAD_INT(wmwin, w->wmwin)
+C2_LOAD_INT(bshaped, w->bounding_shaped)
+C2_LOAD_INT(rounded, w->rounded_corners)
+C2_LOAD_INT(client, w->client_win)
+C2_LOAD_INT(leader, w->leader)
+
+#undef C2_LOAD_INT
+
+static const c2_load_int_t C2_LOAD_INTS[C2_L_PROLE + 1] = {
+  [C2_L_PID]          = c2_load_id,
+  [C2_L_PX]           = c2_load_x,
+  [C2_L_PY]           = c2_load_y,
+  [C2_L_PX2]          = c2_load_x2,
+  [C2_L_PY2]          = c2_load_y2,
+  [C2_L_PWIDTH]       = c2_load_width,
+  [C2_L_PHEIGHT]      = c2_load_height,
+  [C2_L_PWIDTHB]      = c2_load_widthb,
+  [C2_L_PHEIGHTB]     = c2_load_heightb,
+  [C2_L_PBDW]         = c2_load_bdw,
+  [C2_L_PFULLSCREEN]  = c2_load_fullscreen,
+  [C2_L_POVREDIR]     = c2_load_overredir,
+  [C2_L_PARGB]        = c2_load_argb,
+  [C2_L_PFOCUSED]     = c2_load_focused,
+  [C2_L_PWMWIN]       = c2_load_wmwin,
+  [C2_L_PBSHAPED]     = c2_load_bshaped,
+  [C2_L_PROUNDED]     = c2_load_rounded,
+  [C2_L_PCLIENT]      = c2_load_client,
+  [C2_L_PLEADER]      = c2_load_leader,
+};
+
+#define C2_LOAD_STR(name, expr) \
+  static const char *c2_load_ ## name(session_t *ps, win *w) { return (expr); }
+
+C2_LOAD_STR(windowtype, WINTYPES[w->window_type])
+C2_LOAD_STR(name, w->name)
+C2_LOAD_STR(classg, w->class_general)
+C2_LOAD_STR(classi, w->class_instance)
+C2_LOAD_STR(role, w->role)
+
+#undef C2_LOAD_STR
+
+static const c2_load_str_t C2_LOAD_STRS[C2_L_PROLE + 1] = {
+  [C2_L_PWINDOWTYPE]  = c2_load_windowtype,
+  [C2_L_PNAME]        = c2_load_name,
+  [C2_L_PCLASSG]      = c2_load_classg,
+  [C2_L_PCLASSI]      = c2_load_classi,
+  [C2_L_PROLE]        = c2_load_role,
+};
+
+#define C2_CMP_INT(name, expr) \
+  static bool c2_cmp_int_ ## name(long tgt, long ptn) { return (expr); }
+
+C2_CMP_INT(exists, tgt)
+C2_CMP_INT(eq, tgt == ptn)
+C2_CMP_INT(gt, tgt > ptn)
+C2_CMP_INT(gteq, tgt >= ptn)
+C2_CMP_INT(lt, tgt < ptn)
+C2_CMP_INT(lteq, tgt <= ptn)
+
+#undef C2_CMP_INT
+
+static const c2_cmp_int_t C2_CMP_INTS[] = {
+  [C2_L_OEXISTS]  = c2_cmp_int_exists,
+  [C2_L_OEQ]      = c2_cmp_int_eq,
+  [C2_L_OGT]      = c2_cmp_int_gt,
+  [C2_L_OGTEQ]    = c2_cmp_int_gteq,
+  [C2_L_OLT]      = c2_cmp_int_lt,
+  [C2_L_OLTEQ]    = c2_cmp_int_lteq,
+};
+
+#define C2_CMP_STR(name, expr) \
+  static bool c2_cmp_str_ ## name(const c2_l_t *pleaf, const char *tgt) { \
+    return (expr); \
   }
-  // Handle a leaf
-  else {
-    const c2_l_t *pleaf = cond.l;
 
-    if (!pleaf)
-      return false;
+C2_CMP_STR(exists, true)
+C2_CMP_STR(exact, !strcmp(tgt, pleaf->ptnstr))
+C2_CMP_STR(exact_ci, !strcasecmp(tgt, pleaf->ptnstr))
+C2_CMP_STR(contains, strstr(tgt, pleaf->ptnstr))
+C2_CMP_STR(contains_ci, strcasestr(tgt, pleaf->ptnstr))
+C2_CMP_STR(start, !strncmp(tgt, pleaf->ptnstr, strlen(pleaf->ptnstr)))
+C2_CMP_STR(start_ci, !strncasecmp(tgt, pleaf->ptnstr, strlen(pleaf->ptnstr)))
+C2_CMP_STR(wildcard, !fnmatch(pleaf->ptnstr, tgt, 0))
+C2_CMP_STR(wildcard_ci, !fnmatch(pleaf->ptnstr, tgt, FNM_CASEFOLD))
+#ifdef CONFIG_REGEX_PCRE
+C2_CMP_STR(pcre, pcre_exec(pleaf->regex_pcre, pleaf->regex_pcre_extra,
+      tgt, strlen(tgt), 0, 0, NULL, 0) >= 0)
+#endif
 
-    c2_match_once_leaf(ps, w, pleaf, &result, &error);
+#undef C2_CMP_STR
 
-    // For EXISTS operator, no errors are fatal
-    if (C2_L_OEXISTS == pleaf->op && error) {
-      result = false;
-      error = false;
-    }
+/**
+ * Get the matcher of a string leaf.
+ *
+ * @return the matcher, NULL if the leaf can't be matched
+ */
+static c2_cmp_str_t
+c2_cmp_str_get(const c2_l_t *pleaf) {
+  if (C2_L_OEXISTS == pleaf->op)
+    return c2_cmp_str_exists;
+  if (C2_L_OEQ != pleaf->op)
+    return NULL;
 
+  const bool ci = pleaf->match_ignorecase;
+  switch (pleaf->match) {
+    case C2_L_MEXACT:     return ci ? c2_cmp_str_exact_ci: c2_cmp_str_exact;
+    case C2_L_MCONTAINS:  return ci ? c2_cmp_str_contains_ci: c2_cmp_str_contains;
+    case C2_L_MSTART:     return ci ? c2_cmp_str_start_ci: c2_cmp_str_start;
+    case C2_L_MWILDCARD:  return ci ? c2_cmp_str_wildcard_ci: c2_cmp_str_wildcard;
+#ifdef CONFIG_REGEX_PCRE
+    case C2_L_MPCRE:      return c2_cmp_str_pcre;
+#endif
+    default:              return NULL;
+  }
+}
+
+/**
+ * Match a window against a compiled leaf with a predefined string target.
+ *
+ * @return true if matched, false otherwise.
+ */
+static inline bool
+c2_match_str(session_t *ps, win *w, const c2_insn_t *insn) {
+  const c2_l_t *pleaf = insn->leaf;
+  const char *tgt = insn->s.load(ps, w);
+  bool result = false;
+
+  // An unset target never matches, not even with the EXISTS operator
+  if (tgt) {
+    if (pleaf->ms_id >= 0 && ps->c2_ms)
+      result = c2_ms_match(ps, w, pleaf, tgt);
+    else
+      result = insn->s.cmp(pleaf, tgt);
+  }
+
+  return result != pleaf->neg;
+}
+
+/**
+ * Compile a leaf into a single instruction.
+ *
+ * Leaves on predefined targets get their load and comparison resolved now.
+ * Others, which read window properties from the X server anyway, are matched
+ * by c2_match_leaf().
+ */
+static c2_insn_t
+c2_compile_leaf(const c2_l_t *pleaf) {
+  c2_insn_t insn = { .op = C2_I_LEAF, .leaf = pleaf };
 #ifdef DEBUG_WINMATCH
-    printf_dbgf("(%#010lx): leaf: result = %d, error = %d, "
-        "client = %#010lx,  pattern = ",
-        w->id, result, error, w->client_win);
-    c2_dump(cond);
+  // Keep the per-leaf debug output
+  return insn;
 #endif
+
+  // The id is the one of the client window with the on-frame flag
+  if (!pleaf->predef || (C2_L_PID == pleaf->predef && pleaf->tgt_onframe))
+    return insn;
+
+  switch (pleaf->ptntype) {
+    case C2_L_PTINT:
+      if (C2_LOAD_INTS[pleaf->predef]) {
+        insn.op = C2_I_INT;
+        insn.i.load = C2_LOAD_INTS[pleaf->predef];
+        insn.i.cmp = C2_CMP_INTS[pleaf->op];
+      }
+      break;
+    case C2_L_PTSTRING:
+      if (C2_LOAD_STRS[pleaf->predef] && c2_cmp_str_get(pleaf)) {
+        insn.op = C2_I_STR;
+        insn.s.load = C2_LOAD_STRS[pleaf->predef];
+        insn.s.cmp = c2_cmp_str_get(pleaf);
+      }
+      break;
+    default:
+      break;
   }
 
-  // Postprocess the result
-  if (error)
-    result = false;
+  return insn;
+}
+///@}
 
-  if (cond.isbranch ? cond.b->neg: cond.l->neg)
-    result = !result;
+/**
+ * Append an instruction to a program.
+ *
+ * @return index of the new instruction
+ */
+static int
+c2_emit(c2_prog_t *prog, c2_insn_t insn) {
+  prog->insns = crealloc(prog->insns, prog->len + 1);
+  prog->insns[prog->len] = insn;
+  return prog->len++;
+}
 
-  return result;
+/**
+ * Compile a condition tree into a program.
+ *
+ * AND and OR branches jump over their second operand when the first one
+ * decides the result, the same short-circuiting the tree walk did.
+ *
+ * @param depth current depth of the stack
+ */
+static void
+c2_compile_rec(c2_prog_t *prog, const c2_ptr_t p, int depth) {
+  if (!p.isbranch) {
+    // Matching an empty leaf or branch always fails
+    if (!p.l) {
+      c2_emit(prog, (c2_insn_t) { .op = C2_I_FALSE });
+      return;
+    }
+    c2_emit(prog, c2_compile_leaf(p.l));
+    return;
+  }
+
+  const c2_b_t *pb = p.b;
+  if (!pb) {
+    c2_emit(prog, (c2_insn_t) { .op = C2_I_FALSE });
+    return;
+  }
+
+  c2_compile_rec(prog, pb->opr1, depth);
+  switch (pb->op) {
+    case C2_B_OAND:
+    case C2_B_OOR:
+      {
+        int jmp = c2_emit(prog, (c2_insn_t) {
+            .op = (C2_B_OAND == pb->op ? C2_I_JZ: C2_I_JNZ) });
+        c2_compile_rec(prog, pb->opr2, depth);
+        prog->insns[jmp].target = prog->len;
+      }
+      break;
+    case C2_B_OXOR:
+      c2_emit(prog, (c2_insn_t) { .op = C2_I_PUSH });
+      if (depth + 1 > prog->depth)
+        prog->depth = depth + 1;
+      c2_compile_rec(prog, pb->opr2, depth + 1);
+      c2_emit(prog, (c2_insn_t) { .op = C2_I_XOR });
+      break;
+    default:
+      assert(0);
+      break;
+  }
+
+  if (pb->neg)
+    c2_emit(prog, (c2_insn_t) { .op = C2_I_NOT });
+}
+
+/**
+ * Compile a condition tree into a flat program for c2_exec().
+ */
+static void
+c2_compile(c2_prog_t *prog, const c2_ptr_t p) {
+  prog->insns = NULL;
+  prog->len = 0;
+  prog->depth = 0;
+  c2_compile_rec(prog, p, 0);
+}
+
+/**
+ * Match a window against a compiled condition.
+ *
+ * @return true if matched, false otherwise.
+ */
+static bool
+c2_exec(session_t *ps, win *w, const c2_prog_t *prog) {
+  bool stack[prog->depth + 1];
+  int sp = 0;
+  bool acc = false;
+
+  for (int pc = 0; pc < prog->len; pc++) {
+    const c2_insn_t *insn = &prog->insns[pc];
+    switch (insn->op) {
+      case C2_I_LEAF: acc = c2_match_leaf(ps, w, insn->leaf);  break;
+      case C2_I_INT:
+        acc = (insn->i.cmp(insn->i.load(ps, w), insn->leaf->ptnint)
+            != insn->leaf->neg);
+        break;
+      case C2_I_STR:  acc = c2_match_str(ps, w, insn);         break;
+      case C2_I_FALSE: acc = false;                           break;
+      case C2_I_JZ:   if (!acc) pc = insn->target - 1;        break;
+      case C2_I_JNZ:  if (acc) pc = insn->target - 1;         break;
+      case C2_I_NOT:  acc = !acc;                             break;
+      case C2_I_PUSH: assert(sp < prog->depth); stack[sp++] = acc; break;
+      case C2_I_XOR:  assert(sp > 0); acc = (stack[--sp] != acc); break;
+    }
+  }
+
+#ifdef DEBUG_WINMATCH
+  printf_dbgf("(%#010lx): program: result = %d\n", w->id, acc);
+#endif
+
+  return acc;
 }
 
 /**
@@ -1651,7 +2659,7 @@ c2_match(session_t *ps, win *w, const c2_lptr_t *condlst,
   assert(w->a.map_state == XCB_MAP_STATE_VIEWABLE);
 
   // Check if the cached entry matches firstly
-  if (cache && *cache && c2_match_once(ps, w, (*cache)->ptr)) {
+  if (cache && *cache && c2_exec(ps, w, &(*cache)->prog)) {
     if (pdata)
       *pdata = (*cache)->data;
     return true;
@@ -1659,7 +2667,7 @@ c2_match(session_t *ps, win *w, const c2_lptr_t *condlst,
 
   // Then go through the whole linked list
   for (; condlst; condlst = condlst->next) {
-    if (c2_match_once(ps, w, condlst->ptr)) {
+    if (c2_exec(ps, w, &condlst->prog)) {
       if (cache)
         *cache = condlst;
       if (pdata)
@@ -1671,3 +2679,28 @@ c2_match(session_t *ps, win *w, const c2_lptr_t *condlst,
   return false;
 }
 
+/**
+ * Match a window against a condition linked list, reusing the last result
+ * if none of the window data the list depends on changed since.
+ *
+ * @param res result of the last match, updated on a new match
+ * @param pdata a place to return the data
+ * @return true if matched, false otherwise.
+ */
+bool
+c2_match_cached(session_t *ps, win *w, const c2_lptr_t *condlst,
+    c2_result_t *res, void **pdata) {
+  uint32_t deps = 0;
+  for (const c2_lptr_t *p = condlst; p; p = p->next)
+    deps |= p->deps;
+
+  if (res->dirty & deps) {
+    res->data = NULL;
+    res->matched = c2_match(ps, w, condlst, &res->cache, &res->data);
+  }
+  res->dirty = 0;
+
+  if (res->matched && pdata)
+    *pdata = res->data;
+  return res->matched;
+}
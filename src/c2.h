@@ -12,11 +12,50 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <X11/Xlib.h>
 
 typedef struct _c2_lptr c2_lptr_t;
 typedef struct session session_t;
 typedef struct win win;
 
+/// Window data a condition can depend on. Used as bits of a mask.
+enum {
+  C2_DEP_NAME       = 1 << 0,
+  C2_DEP_CLASS      = 1 << 1,
+  C2_DEP_ROLE       = 1 << 2,
+  C2_DEP_GEOMETRY   = 1 << 3,
+  C2_DEP_FOCUS      = 1 << 4,
+  C2_DEP_FULLSCREEN = 1 << 5,
+  C2_DEP_LEADER     = 1 << 6,
+  C2_DEP_WINTYPE    = 1 << 7,
+  C2_DEP_CLIENT     = 1 << 8,
+  C2_DEP_SHAPE      = 1 << 9,
+  /// Window attributes that only change when the window is (re)mapped.
+  C2_DEP_ATTR       = 1 << 10,
+};
+
+/// Dependency bit of a raw window property. Atoms are hashed into the upper
+/// 16 bits, a collision only causes an unnecessary match.
+#define C2_DEP_ATOM(atom) ((uint32_t) 1 << (16 + (atom) % 16))
+#define C2_DEP_ALL UINT32_MAX
+
+/// Result of matching a window against a condition list. The list is only
+/// matched again after some window data it depends on has changed.
+typedef struct c2_result {
+  /// Last matched condition, tried first on the next match.
+  const c2_lptr_t *cache;
+  /// Mask of C2_DEP_* of window data changed since the last match.
+  uint32_t dirty;
+  /// Whether the last match succeeded.
+  bool matched;
+  /// Data of the last matched condition.
+  void *data;
+} c2_result_t;
+
+#define C2_RESULT_INIT { .cache = NULL, .dirty = C2_DEP_ALL, \
+  .matched = false, .data = NULL }
+
 c2_lptr_t *
 c2_parse(session_t *ps, c2_lptr_t **pcondlst, const char *pattern,
     void *data);
@@ -27,3 +66,28 @@ c2_free_lptr(c2_lptr_t *lp);
 bool
 c2_match(session_t *ps, win *w, const c2_lptr_t *condlst,
     const c2_lptr_t **cache, void **pdata);
+
+bool
+c2_match_cached(session_t *ps, win *w, const c2_lptr_t *condlst,
+    c2_result_t *res, void **pdata);
+
+void
+c2_prop_cache_invalidate(win *w, Window wid, Atom atom);
+
+void
+c2_prop_cache_free(win *w);
+
+void
+c2_prop_cache_prefetch(session_t *ps, win *w);
+
+void
+c2_ms_build(session_t *ps);
+
+void
+c2_ms_free(session_t *ps);
+
+void
+c2_ms_result_invalidate(win *w, uint32_t changed);
+
+void
+c2_ms_result_free(win *w);
@@ -34,6 +34,7 @@
 // #define DEBUG_GLX_ERR    1
 // #define DEBUG_GLX_MARK   1
 // #define DEBUG_GLX_PAINTREG 1
+// #define DEBUG_TIMING     1
 
 // Whether to enable PCRE regular expression support in blacklists, enabled
 // by default
@@ -139,6 +140,10 @@
 #include "utils.h"
 #include "compiler.h"
 #include "kernel.h"
+#include "idmap.h"
+#include "atom.h"
+#include "worker.h"
+#include "shm.h"
 
 // === Constants ===
 
@@ -175,6 +180,12 @@
 /// @brief Maximum passes for blur.
 #define MAX_BLUR_PASS 5
 
+/// @brief Maximum strength of the dual Kawase blur.
+#define MAX_BLUR_STRENGTH 10
+
+/// @brief Memory budget for cached shadows no window is using, in bytes.
+#define SHADOW_CACHE_BUDGET (32 * 1024 * 1024)
+
 // Window flags
 
 // Window size is changed
@@ -234,6 +245,13 @@ typedef enum {
   NUM_VSYNC,
 } vsync_t;
 
+/// @brief Possible methods of blurring backgrounds.
+enum blur_method {
+  BLUR_METHOD_KERNEL,
+  BLUR_METHOD_DUAL_KAWASE,
+  NUM_BLUR_METHOD,
+};
+
 /// @brief Possible backends of compton.
 enum backend {
   BKEND_XRENDER,
@@ -305,6 +323,14 @@ typedef struct __GLsync *GLsync;
 #define GL_WAIT_FAILED 0x911D
 #endif
 
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+
+#ifndef GL_SYNC_X11_FENCE_EXT
+#define GL_SYNC_X11_FENCE_EXT 0x90E1
+#endif
+
 typedef GLsync (*f_FenceSync) (GLenum condition, GLbitfield flags);
 typedef GLboolean (*f_IsSync) (GLsync sync);
 typedef void (*f_DeleteSync) (GLsync sync);
@@ -329,6 +355,10 @@ typedef struct {
   bool y_inverted;
 } glx_fbconfig_t;
 
+/// Number of X Sync fences a GLX texture uses in turn, so one isn't reset
+/// while the GPU may still wait on it.
+#define GLX_PIXMAP_FENCES 4
+
 /// @brief Wrapper of a binded GLX texture.
 struct _glx_texture {
   GLuint texture;
@@ -339,6 +369,13 @@ struct _glx_texture {
   unsigned height;
   unsigned depth;
   bool y_inverted;
+  /// X Sync fences the GPU waits on before the pixmap is bound, used in
+  /// turn.
+  XSyncFence fences[GLX_PIXMAP_FENCES];
+  /// GL fences signalled once the GPU is past the wait on each X fence.
+  GLsync fences_done[GLX_PIXMAP_FENCES];
+  /// The X fence to use next.
+  int fence_next;
 };
 
 #ifdef CONFIG_OPENGL
@@ -353,8 +390,47 @@ typedef struct {
   GLint unifm_offset_y;
   /// Location of uniform "factor_center" in blur GLSL program.
   GLint unifm_factor_center;
+  /// Location of uniform "tex_max" in blur GLSL program.
+  GLint unifm_tex_max;
 } glx_blur_pass_t;
 
+typedef struct {
+  /// GLSL program for a dual Kawase blur pass.
+  GLuint prog;
+  /// Location of uniform "pixel" in Kawase GLSL program.
+  GLint unifm_pixel;
+  /// Location of uniform "offset" in Kawase GLSL program.
+  GLint unifm_offset;
+  /// Location of uniform "tex_max" in Kawase GLSL program.
+  GLint unifm_tex_max;
+} glx_kawase_pass_t;
+
+typedef struct {
+  /// GLSL program drawing shadows analytically.
+  GLuint prog;
+  /// Location of uniform "root_height" in shadow GLSL program.
+  GLint unifm_root_height;
+} glx_shadow_prog_t;
+
+typedef struct {
+  /// GLSL program painting windows.
+  GLuint prog;
+  /// Location of uniform "opacity" in window GLSL program.
+  GLint unifm_opacity;
+  /// Location of uniform "frame_opacity" in window GLSL program.
+  GLint unifm_frame_opacity;
+  /// Location of uniform "body" in window GLSL program.
+  GLint unifm_body;
+  /// Location of uniform "root_height" in window GLSL program.
+  GLint unifm_root_height;
+  /// Location of uniform "dim" in window GLSL program.
+  GLint unifm_dim;
+  /// Location of uniform "invert_color" in window GLSL program.
+  GLint unifm_invert_color;
+  /// Location of uniform "tex" in window GLSL program.
+  GLint unifm_tex;
+} glx_win_prog_t;
+
 typedef struct glx_prog_main {
   /// GLSL program.
   GLuint prog;
@@ -386,6 +462,15 @@ typedef struct _latom {
   struct _latom *next;
 } latom_t;
 
+/// Handling of changes of a window property.
+typedef struct {
+  Atom atom;
+  /// Function to call when the property changes, NULL if there is none.
+  void (*handler)(session_t *ps, xcb_property_notify_event_t *ev);
+  /// Whether the property is used by rules.
+  bool tracked;
+} prop_handler_t;
+
 #define REG_DATA_INIT { NULL, 0 }
 
 typedef struct win_option_mask {
@@ -433,6 +518,12 @@ typedef struct options_t {
   bool glx_no_stencil;
   /// Whether to avoid rebinding pixmap on window damage.
   bool glx_no_rebind_pixmap;
+  /// Whether to draw shadows with a fragment shader instead of from
+  /// shadow images.
+  bool glx_analytic_shadow;
+  /// Whether to paint solid windows front to back first, and reject what
+  /// they cover with the depth test.
+  bool glx_front_to_back;
   /// GLX swap method we assume OpenGL uses.
   int glx_swap_method;
   /// Whether to use GL_EXT_gpu_shader4 to (hopefully) accelerates blurring.
@@ -560,6 +651,13 @@ typedef struct options_t {
   c2_lptr_t *blur_background_blacklist;
   /// Blur convolution kernel.
   xcb_render_fixed_t *blur_kerns[MAX_BLUR_PASS];
+  /// Sum of the elements of the blur kernel, if it's been split into a
+  /// horizontal and a vertical pass, 0 otherwise.
+  double blur_kern_split_sum;
+  /// Method used to blur backgrounds.
+  enum blur_method blur_method;
+  /// Strength of the dual Kawase blur, 1 - MAX_BLUR_STRENGTH.
+  int blur_strength;
   /// How much to dim an inactive window. 0.0 - 1.0, 0 to disable.
   double inactive_dim;
   /// Whether to use fixed inactive dim opacity, instead of deciding
@@ -637,10 +735,38 @@ typedef struct {
 #endif
   /// Current GLX Z value.
   int z;
+  /// Whether z is fixed for the window being painted, and isn't advanced for
+  /// every piece of it.
+  bool z_fixed;
+  /// Vertex buffer the quads painted in a frame are streamed into.
+  GLuint vbo;
+  /// Size of the vertex buffer, in vertices.
+  int vbo_size;
+  /// Vertices of the vertex buffer used in this frame.
+  int vbo_used;
+  /// Vertices of the quads of the current paint call.
+  GLfloat *quads;
+  /// Number of vertices in quads.
+  int nquad_verts;
+  /// Number of vertices quads has room for.
+  int quads_cap;
+  /// Vertices of the analytic shadows not painted yet.
+  GLfloat *shadow_verts;
+  /// Number of vertices in shadow_verts.
+  int nshadow_verts;
+  /// Number of vertices shadow_verts has room for.
+  int shadow_verts_cap;
   /// FBConfig-s for GLX pixmap of different depths.
   glx_fbconfig_t *fbconfigs[OPENGL_MAX_DEPTH + 1];
 #ifdef CONFIG_OPENGL
   glx_blur_pass_t blur_passes[MAX_BLUR_PASS];
+  /// Downsampling pass of the dual Kawase blur.
+  glx_kawase_pass_t kawase_down;
+  /// Upsampling pass of the dual Kawase blur.
+  glx_kawase_pass_t kawase_up;
+  glx_shadow_prog_t shadow_prog;
+  /// Built-in programs painting windows, for 2D and rectangle textures.
+  glx_win_prog_t win_progs[2];
 #endif
 } glx_session_t;
 
@@ -671,6 +797,11 @@ typedef struct session {
   ev_signal usr1_signal;
   /// libev mainloop
   struct ev_loop *loop;
+  /// Threads for CPU heavy work, like building shadow images.
+  struct worker_pool *workers;
+  /// Shared memory segments for uploading images. NULL if MIT-SHM is not
+  /// available.
+  struct shm_pool *shm;
   // === Display related ===
   /// Display in use.
   Display *dpy;
@@ -729,6 +860,10 @@ typedef struct session {
   struct timeval time_start;
   /// The region needs to painted on next paint.
   region_t all_damage;
+  /// The part of <code>all_damage</code> not coming from the content of
+  /// windows, which may change the background of any window. Only tracked
+  /// when blurring backgrounds.
+  region_t all_damage_other;
   /// The region damaged on the last paint.
   region_t all_damage_last[CGLX_MAX_BUFFER_AGE];
   /// Whether all windows are currently redirected.
@@ -761,6 +896,17 @@ typedef struct session {
   // === Window related ===
   /// Linked list of all windows.
   win *list;
+  /// Last window in <code>list</code>, i.e. the bottom of the stack.
+  win *list_tail;
+  /// Index of windows in <code>list</code> that are not destroyed, by
+  /// window ID.
+  idmap_t win_index;
+  /// Index of windows in <code>list</code> that are not destroyed, by
+  /// client window ID.
+  idmap_t client_index;
+  /// Whether some windows have properties to refresh before the next
+  /// paint.
+  bool win_props_dirty;
   /// Pointer to <code>win</code> of current active window. Used by
   /// EWMH <code>_NET_ACTIVE_WINDOW</code> focus detection. In theory,
   /// it's more reliable to store the window ID directly here, just in
@@ -774,12 +920,15 @@ typedef struct session {
   // === Shadow/dimming related ===
   /// 1x1 black Picture.
   xcb_render_picture_t black_picture;
-  /// 1x1 Picture of the shadow color.
-  xcb_render_picture_t cshadow_picture;
+  /// 1x1 Pictures of the shadow color, premultiplied by each opacity step
+  /// up to MAX_ALPHA. Created on first use.
+  xcb_render_picture_t *cshadow_picts;
   /// 1x1 white Picture.
   xcb_render_picture_t white_picture;
   /// Gaussian map of shadow.
   conv *gaussian_map;
+  /// Shadows shared between windows of the same size.
+  shadow_cache_t shadow_cache;
   // for shadow precomputation
   /// Shadow depth on one side.
   int cgsize;
@@ -897,6 +1046,17 @@ typedef struct session {
   Atom atoms_wintypes[NUM_WINTYPES];
   /// Linked list of additional atoms to track.
   latom_t *track_atom_lst;
+  /// Linked list of atoms of non-string properties referenced by rules.
+  /// These are prefetched into the property cache of a window.
+  latom_t *prop_atom_lst;
+  /// Registry of atoms and their names.
+  struct atom *atoms;
+  /// Handling of window property changes, sorted by atom.
+  prop_handler_t *prop_handlers;
+  /// Number of elements in <code>prop_handlers</code>.
+  int nprop_handlers;
+  /// Multi-pattern matcher of string conditions in all condition lists.
+  struct c2_ms *c2_ms;
 
 #ifdef CONFIG_DBUS
   // === DBus related ===
@@ -925,6 +1085,7 @@ typedef enum {
 extern const char * const WINTYPES[NUM_WINTYPES];
 extern const char * const VSYNC_STRS[NUM_VSYNC + 1];
 extern const char * const BACKEND_STRS[NUM_BKEND + 1];
+extern const char * const BLUR_METHOD_STRS[NUM_BLUR_METHOD + 1];
 extern session_t *ps_g;
 
 // == Debugging code ==
@@ -1138,6 +1299,21 @@ parse_vsync(session_t *ps, const char *str) {
   return false;
 }
 
+/**
+ * Parse a blur method option argument.
+ */
+static inline bool
+parse_blur_method(session_t *ps, const char *str) {
+  for (enum blur_method i = 0; BLUR_METHOD_STRS[i]; ++i)
+    if (!strcasecmp(str, BLUR_METHOD_STRS[i])) {
+      ps->o.blur_method = i;
+      return true;
+    }
+
+  printf_errf("(\"%s\"): Invalid blur method argument.", str);
+  return false;
+}
+
 /**
  * Parse a backend option argument.
  */
@@ -1232,24 +1408,26 @@ die(const char *msg) {
 }
 
 /**
- * Wrapper of XInternAtom() for convenience.
+ * Get the atom of a name. Only blocks the first time a name is seen.
  */
 static inline xcb_atom_t
 get_atom(session_t *ps, const char *atom_name) {
-  xcb_intern_atom_reply_t *reply =
-    xcb_intern_atom_reply(ps->c,
-        xcb_intern_atom(ps->c, False, strlen(atom_name), atom_name),
-        NULL);
-
-  xcb_atom_t atom = XCB_NONE;
-  if (reply) {
-    atom = reply->atom;
-    free(reply);
-  } else
+  xcb_atom_t atom = atom_get(ps->atoms, atom_name);
+  if (!atom)
     die("Failed to intern atoms, bail out");
   return atom;
 }
 
+/**
+ * Get the name of an atom. Only blocks the first time an atom is seen.
+ *
+ * @return the name, must not be freed. NULL if the atom is invalid.
+ */
+static inline const char *
+get_atom_name(session_t *ps, xcb_atom_t atom) {
+  return atom_get_name(ps->atoms, atom);
+}
+
 /**
  * Return the painting target window.
  */
@@ -1263,17 +1441,9 @@ get_tgt_window(session_t *ps) {
  */
 static inline win *
 find_win(session_t *ps, Window id) {
-  if (!id)
-    return NULL;
-
-  win *w;
-
-  for (w = ps->list; w; w = w->next) {
-    if (w->id == id && !w->destroyed)
-      return w;
-  }
-
-  return 0;
+  // Destroyed windows are dropped from the index as soon as they are
+  // marked, so they never show up here
+  return idmap_get(&ps->win_index, id);
 }
 
 /**
@@ -1284,15 +1454,7 @@ find_win(session_t *ps, Window id) {
  */
 static inline win *
 find_toplevel(session_t *ps, Window id) {
-  if (!id)
-    return NULL;
-
-  for (win *w = ps->list; w; w = w->next) {
-    if (w->client_win == id && !w->destroyed)
-      return w;
-  }
-
-  return NULL;
+  return idmap_get(&ps->client_index, id);
 }
 
 /**
@@ -132,6 +132,13 @@ const char * const BACKEND_STRS[NUM_BKEND + 1] = {
   NULL
 };
 
+/// Names of blur methods.
+const char * const BLUR_METHOD_STRS[NUM_BLUR_METHOD + 1] = {
+  "kernel",       // BLUR_METHOD_KERNEL
+  "dual_kawase",  // BLUR_METHOD_DUAL_KAWASE
+  NULL
+};
+
 /// Names of root window properties that could point to a pixmap of
 /// background.
 const char *background_props_str[] = {
@@ -175,11 +182,17 @@ free_win_res(session_t *ps, win *w) {
   free_paint(ps, &w->paint);
   free_fence(ps, &w->fence);
   pixman_region32_fini(&w->bounding_shape);
-  free_paint(ps, &w->shadow_paint);
+  free_picture(ps->c, &w->blur_cache_pict);
+  pixman_region32_fini(&w->blur_cache_valid);
+  pixman_region32_fini(&w->damage_content);
+  shadow_release(ps, &w->shadow_paint);
+  shadow_release(ps, &w->shadow_pending);
   // BadDamage may be thrown if the window is destroyed
   set_ignore_cookie(ps,
       xcb_damage_destroy(ps->c, w->damage));
   rc_region_unref(&w->reg_ignore);
+  c2_prop_cache_free(w);
+  c2_ms_result_free(w);
   free(w->name);
   free(w->class_instance);
   free(w->class_general);
@@ -338,6 +351,26 @@ void add_damage(session_t *ps, const region_t *damage) {
   if (!damage)
     return;
   pixman_region32_union(&ps->all_damage, &ps->all_damage, (region_t *)damage);
+  if (ps->o.blur_background)
+    pixman_region32_union(&ps->all_damage_other, &ps->all_damage_other,
+        (region_t *)damage);
+}
+
+/**
+ * Add damage caused by the content of a window.
+ *
+ * Unlike other damage, it can only change the background of the windows
+ * above the window.
+ */
+static void
+add_damage_from_content(session_t *ps, win *w, const region_t *damage) {
+  if (!ps->redirected)
+    return;
+
+  pixman_region32_union(&ps->all_damage, &ps->all_damage, (region_t *)damage);
+  if (ps->o.blur_background)
+    pixman_region32_union(&w->damage_content, &w->damage_content,
+        (region_t *)damage);
 }
 
 // === Fading ===
@@ -548,6 +581,9 @@ static win *
 paint_preprocess(session_t *ps, win *list) {
   win *t = NULL, *next = NULL;
 
+  // Refresh window properties that changed since the last paint
+  win_refresh_dirty_props(ps);
+
   // Fading step calculation
   time_ms_t steps = 0L;
   if (ps->fade_time)
@@ -649,6 +685,16 @@ paint_preprocess(session_t *ps, win *list) {
     if (!to_paint)
       goto skip_window;
 
+#ifdef DEBUG_TIMING
+    if (!was_painted && w->map_time.tv_sec) {
+      struct timespec now = get_time_timespec(), diff;
+      timespec_subtract(&diff, &now, &w->map_time);
+      printf_dbgf("(%#010lx): First painted %ld.%06ld ms after map.\n", w->id,
+          diff.tv_sec * 1000 + diff.tv_nsec / 1000000, diff.tv_nsec % 1000000);
+      w->map_time = (struct timespec) { 0, 0 };
+    }
+#endif
+
     // Calculate shadow opacity
     w->shadow_opacity = ps->o.shadow_opacity * get_opacity_percent(w) * ps->o.frame_opacity;
 
@@ -817,7 +863,7 @@ repair_win(session_t *ps, win *w) {
   if (w->reg_ignore && win_is_region_ignore_valid(ps, w))
     pixman_region32_subtract(&parts, &parts, w->reg_ignore);
 
-  add_damage(ps, &parts);
+  add_damage_from_content(ps, w, &parts);
   pixman_region32_fini(&parts);
 }
 
@@ -854,6 +900,9 @@ map_win(session_t *ps, Window id) {
   assert(!win_is_focused_real(ps, w));
 
   w->a.map_state = XCB_MAP_STATE_VIEWABLE;
+#ifdef DEBUG_TIMING
+  w->map_time = get_time_timespec();
+#endif
 
   cxinerama_win_upd_scr(ps, w);
 
@@ -897,14 +946,11 @@ map_win(session_t *ps, Window id) {
   // Update window focus state
   win_update_focused(ps, w);
 
-  // Update opacity and dim state
-  win_update_opacity_prop(ps, w);
+  // Update opacity and dim state, and check for _COMPTON_SHADOW
+  win_update_props(ps, w, WIN_PROP_OPACITY
+      | (ps->o.respect_prop_shadow ? WIN_PROP_SHADOW: 0));
   w->flags |= WFLAG_OPCT_CHANGE;
 
-  // Check for _COMPTON_SHADOW
-  if (ps->o.respect_prop_shadow)
-    win_update_prop_shadow_raw(ps, w);
-
   // Many things above could affect shadow
   win_determine_shadow(ps, w);
 
@@ -948,7 +994,11 @@ finish_unmap_win(session_t *ps, win **_w) {
   add_damage_from_win(ps, w);
 
   free_paint(ps, &w->paint);
-  free_paint(ps, &w->shadow_paint);
+  shadow_release(ps, &w->shadow_paint);
+  shadow_release(ps, &w->shadow_pending);
+  free_picture(ps->c, &w->blur_cache_pict);
+  pixman_region32_clear(&w->blur_cache_valid);
+  pixman_region32_clear(&w->damage_content);
 }
 
 static void
@@ -1000,42 +1050,38 @@ restack_win(session_t *ps, win *w, Window new_above) {
   }
 
   if (old_above != new_above) {
-    w->reg_ignore_valid = false;
-    rc_region_unref(&w->reg_ignore);
-    if (w->next) {
-      w->next->reg_ignore_valid = false;
-      rc_region_unref(&w->next->reg_ignore);
-    }
+    win *below = find_win(ps, new_above);
 
-    win **prev = NULL, **prev_old = NULL;
-
-    // unhook
-    for (prev = &ps->list; *prev; prev = &(*prev)->next) {
-      if ((*prev) == w) break;
-    }
-
-    prev_old = prev;
-
-    bool found = false;
-
-    // rehook
-    for (prev = &ps->list; *prev; prev = &(*prev)->next) {
-      if ((*prev)->id == new_above && !(*prev)->destroyed) {
-        found = true;
-        break;
-      }
-    }
-
-    if (new_above && !found) {
+    if (new_above && !below) {
       printf_errf("(%#010lx, %#010lx): "
           "Failed to found new above window.", w->id, new_above);
       return;
     }
 
-    *prev_old = w->next;
+    // Only windows between the old and the new position of w get a
+    // different set of windows above them, so only their reg_ignore needs
+    // rebuilding. Search both ways at once to find which direction w moved.
+    win *old_prev = w->prev, *old_next = w->next;
+    win *up = old_prev, *down = old_next;
+    while (down != below && (!up || up != below)) {
+      if (down)
+        down = down->next;
+      if (up)
+        up = up->prev;
+    }
+    if (down == below) {
+      // Moved down
+      for (win *i = old_next; i != below; i = i->next)
+        rc_region_unref(&i->reg_ignore);
+    } else {
+      // Moved up
+      for (win *i = below; i != w; i = i->next)
+        rc_region_unref(&i->reg_ignore);
+    }
+    rc_region_unref(&w->reg_ignore);
 
-    w->next = *prev;
-    *prev = w;
+    win_stack_remove(ps, w);
+    win_stack_insert(ps, w, below);
 
     // add damage for this window
     add_damage_from_win(ps, w);
@@ -1102,6 +1148,8 @@ configure_win(session_t *ps, xcb_configure_notify_event_t *ce) {
         printf_errf("(): Failed to reinitialize GLX, troubles ahead.");
       if (BKEND_GLX == ps->o.backend && !glx_init_blur(ps))
         printf_errf("(): Failed to initialize filters.");
+      if (ps->o.glx_analytic_shadow && !glx_init_shadow(ps))
+        printf_errf("(): Failed to initialize shadow program.");
     }
 
     // GLX root change callback
@@ -1161,7 +1209,7 @@ configure_win(session_t *ps, xcb_configure_notify_event_t *ce) {
     pixman_region32_fini(&new_extents);
 
     if (factor_change) {
-      win_on_factor_change(ps, w);
+      win_on_factor_change(ps, w, C2_DEP_GEOMETRY | C2_DEP_FULLSCREEN);
       add_damage(ps, &damage);
       cxinerama_win_upd_scr(ps, w);
     }
@@ -1194,38 +1242,30 @@ static void
 finish_destroy_win(session_t *ps, win **_w) {
   win *w = *_w;
   assert(w->destroyed);
-  win **prev = NULL, *i = NULL;
 
 #ifdef DEBUG_EVENTS
-  printf_dbgf("(%#010lx): Starting...\n", w->id);
+  printf_dbgf("(%#010lx \"%s\"): %p\n", w->id, w->name, w);
 #endif
 
-  for (prev = &ps->list; (i = *prev); prev = &i->next) {
-    if (w == i) {
-#ifdef DEBUG_EVENTS
-      printf_dbgf("(%#010lx \"%s\"): %p\n", w->id, w->name, w);
-#endif
-
-      finish_unmap_win(ps, _w);
-      *prev = w->next;
+  finish_unmap_win(ps, _w);
+  win_stack_remove(ps, w);
+  idmap_remove(&ps->win_index, w->id, w);
+  idmap_remove(&ps->client_index, w->client_win, w);
 
-      // Clear active_win if it's pointing to the destroyed window
-      if (w == ps->active_win)
-        ps->active_win = NULL;
+  // Clear active_win if it's pointing to the destroyed window
+  if (w == ps->active_win)
+    ps->active_win = NULL;
 
-      free_win_res(ps, w);
+  free_win_res(ps, w);
 
-      // Drop w from all prev_trans to avoid accessing freed memory in
-      // repair_win()
-      for (win *w2 = ps->list; w2; w2 = w2->next)
-        if (w == w2->prev_trans)
-          w2->prev_trans = NULL;
+  // Drop w from all prev_trans to avoid accessing freed memory in
+  // repair_win()
+  for (win *w2 = ps->list; w2; w2 = w2->next)
+    if (w == w2->prev_trans)
+      w2->prev_trans = NULL;
 
-      free(w);
-      *_w = NULL;
-      break;
-    }
-  }
+  free(w);
+  *_w = NULL;
 }
 
 static void
@@ -1240,6 +1280,9 @@ destroy_win(session_t *ps, Window id) {
     unmap_win(ps, &w);
 
     w->destroyed = true;
+    // Later windows can reuse the ID, drop this one from the lookup indices
+    idmap_remove(&ps->win_index, w->id, w);
+    idmap_remove(&ps->client_index, w->client_win, w);
 
     if (ps->o.no_fading_destroyed_argb)
       win_determine_fade(ps, w);
@@ -1665,22 +1708,165 @@ update_ewmh_active_win(session_t *ps) {
   if (w) win_set_focused(ps, w, true);
 }
 
+/**
+ * Handle a change of WM_STATE of a window.
+ */
+static void
+ev_prop_wm_state(session_t *ps, xcb_property_notify_event_t *ev) {
+  // Check whether it could be a client window
+  if (find_toplevel(ps, ev->window))
+    return;
+
+  // Reset event mask anyway
+  xcb_change_window_attributes(ps->c, ev->window, XCB_CW_EVENT_MASK, (const uint32_t[]) {
+      determine_evmask(ps, ev->window, WIN_EVMODE_UNKNOWN) });
+
+  win *w_top = find_toplevel2(ps, ev->window);
+  // Initialize client_win as early as possible
+  if (w_top && (!w_top->client_win || w_top->client_win == w_top->id)
+      && wid_has_prop(ps, ev->window, ps->atom_client)) {
+    w_top->wmwin = false;
+    win_unmark_client(ps, w_top);
+    win_mark_client(ps, w_top, ev->window);
+  }
+}
+
+/**
+ * Handle a change of _NET_WM_WINDOW_TYPE of a window.
+ *
+ * God knows why this would happen, but there are always some stupid
+ * applications. (#144)
+ */
+static void
+ev_prop_wintype(session_t *ps, xcb_property_notify_event_t *ev) {
+  win *w = find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_WINTYPE);
+}
+
+static void
+ev_prop_opacity(session_t *ps, xcb_property_notify_event_t *ev) {
+  win *w = find_win(ps, ev->window) ?: find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_OPACITY);
+}
+
+static void
+ev_prop_frame_extents(session_t *ps, xcb_property_notify_event_t *ev) {
+  if (!ps->o.frame_opacity)
+    return;
+  win *w = find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_FRAME_EXTENTS);
+}
+
+static void
+ev_prop_name(session_t *ps, xcb_property_notify_event_t *ev) {
+  if (!ps->o.track_wdata)
+    return;
+  win *w = find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_NAME);
+}
+
+static void
+ev_prop_class(session_t *ps, xcb_property_notify_event_t *ev) {
+  if (!ps->o.track_wdata)
+    return;
+  win *w = find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_CLASS);
+}
+
+static void
+ev_prop_role(session_t *ps, xcb_property_notify_event_t *ev) {
+  if (!ps->o.track_wdata)
+    return;
+  win *w = find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_ROLE);
+}
+
+static void
+ev_prop_shadow(session_t *ps, xcb_property_notify_event_t *ev) {
+  if (!ps->o.respect_prop_shadow)
+    return;
+  win *w = find_win(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_SHADOW);
+}
+
+static void
+ev_prop_leader(session_t *ps, xcb_property_notify_event_t *ev) {
+  if (!(ps->o.detect_transient && ps->atom_transient == ev->atom)
+      && !(ps->o.detect_client_leader && ps->atom_client_leader == ev->atom))
+    return;
+  win *w = find_toplevel(ps, ev->window);
+  if (w)
+    win_mark_props_dirty(ps, w, WIN_PROP_LEADER);
+}
+
+static int
+prop_handler_cmp(const void *a, const void *b) {
+  const Atom atom_a = ((const prop_handler_t *) a)->atom;
+  const Atom atom_b = ((const prop_handler_t *) b)->atom;
+  return (atom_a > atom_b) - (atom_a < atom_b);
+}
+
+/**
+ * Build the table of handlers of window property changes. Must be called
+ * after atoms are fetched, and rules are parsed.
+ */
+static void
+init_prop_handlers(session_t *ps) {
+  const prop_handler_t handlers[] = {
+    { ps->atom_client, ev_prop_wm_state, false },
+    { ps->atom_win_type, ev_prop_wintype, false },
+    { ps->atom_opacity, ev_prop_opacity, false },
+    { ps->atom_frame_extents, ev_prop_frame_extents, false },
+    { ps->atom_name, ev_prop_name, false },
+    { ps->atom_name_ewmh, ev_prop_name, false },
+    { ps->atom_class, ev_prop_class, false },
+    { ps->atom_role, ev_prop_role, false },
+    { ps->atom_compton_shadow, ev_prop_shadow, false },
+    { ps->atom_transient, ev_prop_leader, false },
+    { ps->atom_client_leader, ev_prop_leader, false },
+  };
+
+  int n = ARR_SIZE(handlers);
+  for (latom_t *platom = ps->track_atom_lst; platom; platom = platom->next)
+    ++n;
+
+  ps->prop_handlers = ccalloc(n, prop_handler_t);
+  memcpy(ps->prop_handlers, handlers, sizeof(handlers));
+  n = ARR_SIZE(handlers);
+  for (latom_t *platom = ps->track_atom_lst; platom; platom = platom->next)
+    ps->prop_handlers[n++] = (prop_handler_t) { platom->atom, NULL, true };
+  qsort(ps->prop_handlers, n, sizeof(prop_handler_t), prop_handler_cmp);
+
+  // Merge entries of the same atom. No two handlers share an atom, but a
+  // property handled here can be used by rules as well.
+  int len = 0;
+  for (int i = 0; i < n; ++i) {
+    if (len && ps->prop_handlers[len - 1].atom == ps->prop_handlers[i].atom) {
+      prop_handler_t *prev = &ps->prop_handlers[len - 1];
+      prev->tracked = prev->tracked || ps->prop_handlers[i].tracked;
+      if (!prev->handler)
+        prev->handler = ps->prop_handlers[i].handler;
+      continue;
+    }
+    ps->prop_handlers[len++] = ps->prop_handlers[i];
+  }
+  ps->nprop_handlers = len;
+}
+
 inline static void
 ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
 #ifdef DEBUG_EVENTS
   {
     // Print out changed atom
-    xcb_get_atom_name_reply_t *reply =
-      xcb_get_atom_name_reply(ps->c, xcb_get_atom_name(ps->c, ev->atom), NULL);
-    const char *name = "?";
-    int name_len = 1;
-    if (reply) {
-        name = xcb_get_atom_name_name(reply);
-        name_len = xcb_get_atom_name_name_length(reply);
-    }
-
-    printf_dbg("  { atom = %.*s }\n", name_len, name);
-    free(reply);
+    const char *name = get_atom_name(ps, ev->atom);
+    printf_dbg("  { atom = %s }\n", name ? name: "?");
   }
 #endif
 
@@ -1690,7 +1876,8 @@ ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
       update_ewmh_active_win(ps);
     }
     else {
-      // Destroy the root "image" if the wallpaper probably changed
+      // Destroy the root "image" if the wallpaper probably changed. The
+      // atoms are registered at startup, so this doesn't block.
       for (int p = 0; background_props_str[p]; p++) {
         if (ev->atom == get_atom(ps, background_props_str[p])) {
           root_damaged(ps);
@@ -1703,103 +1890,26 @@ ev_property_notify(session_t *ps, xcb_property_notify_event_t *ev) {
     return;
   }
 
-  // If WM_STATE changes
-  if (ev->atom == ps->atom_client) {
-    // Check whether it could be a client window
-    if (!find_toplevel(ps, ev->window)) {
-      // Reset event mask anyway
-      xcb_change_window_attributes(ps->c, ev->window, XCB_CW_EVENT_MASK, (const uint32_t[]) {
-          determine_evmask(ps, ev->window, WIN_EVMODE_UNKNOWN) });
-
-      win *w_top = find_toplevel2(ps, ev->window);
-      // Initialize client_win as early as possible
-      if (w_top && (!w_top->client_win || w_top->client_win == w_top->id)
-          && wid_has_prop(ps, ev->window, ps->atom_client)) {
-        w_top->wmwin = false;
-        win_unmark_client(ps, w_top);
-        win_mark_client(ps, w_top, ev->window);
-      }
-    }
-  }
-
-  // If _NET_WM_WINDOW_TYPE changes... God knows why this would happen, but
-  // there are always some stupid applications. (#144)
-  if (ev->atom == ps->atom_win_type) {
-    win *w = NULL;
-    if ((w = find_toplevel(ps, ev->window)))
-      win_upd_wintype(ps, w);
-  }
-
-  // If _NET_WM_OPACITY changes
-  if (ev->atom == ps->atom_opacity) {
-    win *w = find_win(ps, ev->window) ?: find_toplevel(ps, ev->window);
-    if (w) {
-      win_update_opacity_prop(ps, w);
-      w->flags |= WFLAG_OPCT_CHANGE;
-    }
-  }
-
-  // If frame extents property changes
-  if (ps->o.frame_opacity && ev->atom == ps->atom_frame_extents) {
-    win *w = find_toplevel(ps, ev->window);
-    if (w) {
-      win_update_frame_extents(ps, w, ev->window);
-      // If frame extents change, the window needs repaint
-      add_damage_from_win(ps, w);
-    }
-  }
-
-  // If name changes
-  if (ps->o.track_wdata
-      && (ps->atom_name == ev->atom || ps->atom_name_ewmh == ev->atom)) {
-    win *w = find_toplevel(ps, ev->window);
-    if (w && 1 == win_get_name(ps, w)) {
-      win_on_factor_change(ps, w);
-    }
-  }
-
-  // If class changes
-  if (ps->o.track_wdata && ps->atom_class == ev->atom) {
-    win *w = find_toplevel(ps, ev->window);
-    if (w) {
-      win_get_class(ps, w);
-      win_on_factor_change(ps, w);
-    }
-  }
+  const prop_handler_t key = { .atom = ev->atom };
+  const prop_handler_t *h = bsearch(&key, ps->prop_handlers,
+      ps->nprop_handlers, sizeof(prop_handler_t), prop_handler_cmp);
+  if (!h)
+    return;
 
-  // If role changes
-  if (ps->o.track_wdata && ps->atom_role == ev->atom) {
-    win *w = find_toplevel(ps, ev->window);
-    if (w && 1 == win_get_role(ps, w)) {
-      win_on_factor_change(ps, w);
-    }
-  }
+  // Handlers only mark what changed, properties are refreshed before the
+  // next paint. So a property changing many times in a frame is only
+  // fetched once.
+  if (h->handler)
+    h->handler(ps, ev);
 
-  // If _COMPTON_SHADOW changes
-  if (ps->o.respect_prop_shadow && ps->atom_compton_shadow == ev->atom) {
+  // Check for other atoms we are tracking
+  if (h->tracked) {
     win *w = find_win(ps, ev->window);
-    if (w)
-      win_update_prop_shadow(ps, w);
-  }
-
-  // If a leader property changes
-  if ((ps->o.detect_transient && ps->atom_transient == ev->atom)
-      || (ps->o.detect_client_leader && ps->atom_client_leader == ev->atom)) {
-    win *w = find_toplevel(ps, ev->window);
+    if (!w)
+      w = find_toplevel(ps, ev->window);
     if (w) {
-      win_update_leader(ps, w);
-    }
-  }
-
-  // Check for other atoms we are tracking
-  for (latom_t *platom = ps->track_atom_lst; platom; platom = platom->next) {
-    if (platom->atom == ev->atom) {
-      win *w = find_win(ps, ev->window);
-      if (!w)
-        w = find_toplevel(ps, ev->window);
-      if (w)
-        win_on_factor_change(ps, w);
-      break;
+      c2_prop_cache_invalidate(w, ev->window, ev->atom);
+      win_on_factor_change(ps, w, C2_DEP_ATOM(ev->atom));
     }
   }
 }
@@ -2249,6 +2359,15 @@ usage(int ret) {
     "  7x7box, 3x3gaussian, 5x5gaussian, 7x7gaussian, 9x9gaussian,\n"
     "  11x11gaussian.\n"
     "\n"
+    "--blur-method method\n"
+    "  Method used to blur backgrounds, kernel (default) or dual_kawase.\n"
+    "  dual_kawase downsamples the background and scales it back up, its\n"
+    "  cost barely grows with the strength. It's only available with the\n"
+    "  GLX backend, and doesn't change with window opacity.\n"
+    "\n"
+    "--blur-strength integer\n"
+    "  Strength of the dual_kawase blur, 1 - 10. (default 5)\n"
+    "\n"
     "--blur-background-exclude condition\n"
     "  Exclude conditions for background blur.\n"
     "\n"
@@ -2306,6 +2425,14 @@ usage(int ret) {
     "  known to break things on some drivers (LLVMpipe, xf86-video-intel,\n"
     "  etc.).\n"
     "\n"
+    "--glx-analytic-shadow\n"
+    "  GLX backend: Draw shadows with a fragment shader, instead of\n"
+    "  building and uploading an image for each window size.\n"
+    "\n"
+    "--glx-front-to-back\n"
+    "  GLX backend: Paint solid windows front to back first, and let the\n"
+    "  depth test reject everything they cover.\n"
+    "\n"
     "--glx-swap-method undefined/copy/exchange/3/4/5/6/buffer-age\n"
     "  GLX backend: GLX buffer swap method we assume. Could be\n"
     "  undefined (0), copy (1), exchange (2), 3-6, or buffer-age (-1).\n"
@@ -2607,6 +2734,10 @@ get_cfg(session_t *ps, int argc, char *const *argv, bool first_pass) {
     { "version", no_argument, NULL, 318 },
     { "no-x-selection", no_argument, NULL, 319 },
     { "no-name-pixmap", no_argument, NULL, 320 },
+    { "glx-analytic-shadow", no_argument, NULL, 321 },
+    { "blur-method", required_argument, NULL, 322 },
+    { "blur-strength", required_argument, NULL, 323 },
+    { "glx-front-to-back", no_argument, NULL, 324 },
     { "reredir-on-root-change", no_argument, NULL, 731 },
     { "glx-reinit-on-root-change", no_argument, NULL, 732 },
     { "monitor-repaint", no_argument, NULL, 800 },
@@ -2896,6 +3027,14 @@ get_cfg(session_t *ps, int argc, char *const *argv, bool first_pass) {
           "an issue to let us know\n");
         break;
       P_CASEBOOL(319, no_x_selection);
+      P_CASEBOOL(321, glx_analytic_shadow);
+      case 322:
+        // --blur-method
+        if (!parse_blur_method(ps, optarg))
+          exit(1);
+        break;
+      P_CASELONG(323, blur_strength);
+      P_CASEBOOL(324, glx_front_to_back);
       P_CASEBOOL(731, reredir_on_root_change);
       P_CASEBOOL(732, glx_reinit_on_root_change);
       P_CASEBOOL(800, monitor_repaint);
@@ -2926,6 +3065,8 @@ get_cfg(session_t *ps, int argc, char *const *argv, bool first_pass) {
   ps->o.frame_opacity = normalize_d(ps->o.frame_opacity);
   ps->o.shadow_opacity = normalize_d(ps->o.shadow_opacity);
   ps->o.refresh_rate = normalize_i_range(ps->o.refresh_rate, 0, 300);
+  ps->o.blur_strength = normalize_i_range(ps->o.blur_strength, 1,
+      MAX_BLUR_STRENGTH);
 
   // Apply default wintype options that are dependent on global options
   for (int i = 0; i < NUM_WINTYPES; i++) {
@@ -2945,6 +3086,13 @@ get_cfg(session_t *ps, int argc, char *const *argv, bool first_pass) {
   if (ps->o.blur_background_frame)
     ps->o.blur_background = true;
 
+  if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE
+      && ps->o.backend != BKEND_GLX) {
+    printf_errf("(): dual_kawase blur only works with the glx backend, "
+        "falling back to kernel blur.");
+    ps->o.blur_method = BLUR_METHOD_KERNEL;
+  }
+
   if (ps->o.xrender_sync_fence)
     ps->o.xrender_sync = true;
 
@@ -2979,6 +3127,11 @@ get_cfg(session_t *ps, int argc, char *const *argv, bool first_pass) {
     memcpy(ps->o.blur_kerns[0], convolution_blur, sizeof(convolution_blur));
   }
 
+  // Separable kernels are blurred in two passes
+  if (ps->o.blur_background && ps->o.blur_method == BLUR_METHOD_KERNEL)
+    ps->o.blur_kern_split_sum =
+      split_conv_kern_lst(ps->o.blur_kerns, MAX_BLUR_PASS);
+
   rebuild_shadow_exclude_reg(ps);
 
   if (ps->o.resize_damage < 0)
@@ -2990,48 +3143,64 @@ get_cfg(session_t *ps, int argc, char *const *argv, bool first_pass) {
  */
 static void
 init_atoms(session_t *ps) {
-  ps->atom_opacity = get_atom(ps, "_NET_WM_WINDOW_OPACITY");
-  ps->atom_frame_extents = get_atom(ps, "_NET_FRAME_EXTENTS");
-  ps->atom_client = get_atom(ps, "WM_STATE");
+  const struct {
+    const char *name;
+    Atom *patom;
+  } atoms[] = {
+    { "_NET_WM_WINDOW_OPACITY", &ps->atom_opacity },
+    { "_NET_FRAME_EXTENTS", &ps->atom_frame_extents },
+    { "WM_STATE", &ps->atom_client },
+    { "_NET_WM_NAME", &ps->atom_name_ewmh },
+    { "WM_WINDOW_ROLE", &ps->atom_role },
+    { "WM_CLIENT_LEADER", &ps->atom_client_leader },
+    { "_NET_ACTIVE_WINDOW", &ps->atom_ewmh_active_win },
+    { "_COMPTON_SHADOW", &ps->atom_compton_shadow },
+    { "_NET_WM_WINDOW_TYPE", &ps->atom_win_type },
+    { "_NET_WM_WINDOW_TYPE_DESKTOP", &ps->atoms_wintypes[WINTYPE_DESKTOP] },
+    { "_NET_WM_WINDOW_TYPE_DOCK", &ps->atoms_wintypes[WINTYPE_DOCK] },
+    { "_NET_WM_WINDOW_TYPE_TOOLBAR", &ps->atoms_wintypes[WINTYPE_TOOLBAR] },
+    { "_NET_WM_WINDOW_TYPE_MENU", &ps->atoms_wintypes[WINTYPE_MENU] },
+    { "_NET_WM_WINDOW_TYPE_UTILITY", &ps->atoms_wintypes[WINTYPE_UTILITY] },
+    { "_NET_WM_WINDOW_TYPE_SPLASH", &ps->atoms_wintypes[WINTYPE_SPLASH] },
+    { "_NET_WM_WINDOW_TYPE_DIALOG", &ps->atoms_wintypes[WINTYPE_DIALOG] },
+    { "_NET_WM_WINDOW_TYPE_NORMAL", &ps->atoms_wintypes[WINTYPE_NORMAL] },
+    { "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
+      &ps->atoms_wintypes[WINTYPE_DROPDOWN_MENU] },
+    { "_NET_WM_WINDOW_TYPE_POPUP_MENU",
+      &ps->atoms_wintypes[WINTYPE_POPUP_MENU] },
+    { "_NET_WM_WINDOW_TYPE_TOOLTIP", &ps->atoms_wintypes[WINTYPE_TOOLTIP] },
+    { "_NET_WM_WINDOW_TYPE_NOTIFICATION",
+      &ps->atoms_wintypes[WINTYPE_NOTIFY] },
+    { "_NET_WM_WINDOW_TYPE_COMBO", &ps->atoms_wintypes[WINTYPE_COMBO] },
+    { "_NET_WM_WINDOW_TYPE_DND", &ps->atoms_wintypes[WINTYPE_DND] },
+  };
+
+  int nbg = 0;
+  while (background_props_str[nbg])
+    ++nbg;
+
+  // Intern everything in one go. Background properties are looked up on
+  // every root property change, so they are registered here too.
+  const int n = ARR_SIZE(atoms) + nbg;
+  auto names = ccalloc(n, const char *);
+  auto results = ccalloc(n, xcb_atom_t);
+  for (size_t i = 0; i < ARR_SIZE(atoms); ++i)
+    names[i] = atoms[i].name;
+  for (int i = 0; i < nbg; ++i)
+    names[ARR_SIZE(atoms) + i] = background_props_str[i];
+
+  if (!atom_intern_many(ps->atoms, names, n, results))
+    die("Failed to intern atoms, bail out");
+
+  for (size_t i = 0; i < ARR_SIZE(atoms); ++i)
+    *atoms[i].patom = results[i];
+  free(names);
+  free(results);
+
   ps->atom_name = XCB_ATOM_WM_NAME;
-  ps->atom_name_ewmh = get_atom(ps, "_NET_WM_NAME");
   ps->atom_class = XCB_ATOM_WM_CLASS;
-  ps->atom_role = get_atom(ps, "WM_WINDOW_ROLE");
   ps->atom_transient = XCB_ATOM_WM_TRANSIENT_FOR;
-  ps->atom_client_leader = get_atom(ps, "WM_CLIENT_LEADER");
-  ps->atom_ewmh_active_win = get_atom(ps, "_NET_ACTIVE_WINDOW");
-  ps->atom_compton_shadow = get_atom(ps, "_COMPTON_SHADOW");
-
-  ps->atom_win_type = get_atom(ps, "_NET_WM_WINDOW_TYPE");
   ps->atoms_wintypes[WINTYPE_UNKNOWN] = 0;
-  ps->atoms_wintypes[WINTYPE_DESKTOP] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DESKTOP");
-  ps->atoms_wintypes[WINTYPE_DOCK] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DOCK");
-  ps->atoms_wintypes[WINTYPE_TOOLBAR] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_TOOLBAR");
-  ps->atoms_wintypes[WINTYPE_MENU] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_MENU");
-  ps->atoms_wintypes[WINTYPE_UTILITY] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_UTILITY");
-  ps->atoms_wintypes[WINTYPE_SPLASH] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_SPLASH");
-  ps->atoms_wintypes[WINTYPE_DIALOG] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DIALOG");
-  ps->atoms_wintypes[WINTYPE_NORMAL] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_NORMAL");
-  ps->atoms_wintypes[WINTYPE_DROPDOWN_MENU] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU");
-  ps->atoms_wintypes[WINTYPE_POPUP_MENU] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_POPUP_MENU");
-  ps->atoms_wintypes[WINTYPE_TOOLTIP] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_TOOLTIP");
-  ps->atoms_wintypes[WINTYPE_NOTIFY] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_NOTIFICATION");
-  ps->atoms_wintypes[WINTYPE_COMBO] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_COMBO");
-  ps->atoms_wintypes[WINTYPE_DND] = get_atom(ps,
-      "_NET_WM_WINDOW_TYPE_DND");
 }
 
 /**
@@ -3290,13 +3459,17 @@ _draw_callback(EV_P_ session_t *ps, int revents) {
   }
 
   // If the screen is unredirected, free all_damage to stop painting
-  if (!ps->redirected || ps->o.stoppaint_force == ON)
+  if (!ps->redirected || ps->o.stoppaint_force == ON) {
     pixman_region32_clear(&ps->all_damage);
+    pixman_region32_clear(&ps->all_damage_other);
+  }
 
   if (pixman_region32_not_empty(&ps->all_damage)) {
     region_t all_damage_orig, *region_real = NULL;
     pixman_region32_init(&all_damage_orig);
 
+    paint_blur_invalidate(ps, &ps->all_damage, t);
+
     // keep a copy of non-resized all_damage for region_real
     if (ps->o.resize_damage > 0) {
       copy_region(&all_damage_orig, &ps->all_damage);
@@ -3308,6 +3481,7 @@ _draw_callback(EV_P_ session_t *ps, int revents) {
     paint_all(ps, &ps->all_damage, region_real, t);
 
     pixman_region32_clear(&ps->all_damage);
+    pixman_region32_clear(&ps->all_damage_other);
     pixman_region32_fini(&all_damage_orig);
 
     paint++;
@@ -3477,6 +3651,8 @@ session_init(session_t *ps_old, int argc, char **argv) {
       .blur_background_fixed = false,
       .blur_background_blacklist = NULL,
       .blur_kerns = { NULL },
+      .blur_method = BLUR_METHOD_KERNEL,
+      .blur_strength = 5,
       .inactive_dim = 0.0,
       .inactive_dim_fixed = false,
       .invert_color_list = NULL,
@@ -3506,11 +3682,12 @@ session_init(session_t *ps_old, int argc, char **argv) {
     .n_expose = 0,
 
     .list = NULL,
+    .list_tail = NULL,
     .active_win = NULL,
     .active_leader = None,
 
     .black_picture = None,
-    .cshadow_picture = None,
+    .cshadow_picts = NULL,
     .white_picture = None,
     .gaussian_map = NULL,
     .cgsize = 0,
@@ -3561,6 +3738,11 @@ session_init(session_t *ps_old, int argc, char **argv) {
     .atom_win_type = None,
     .atoms_wintypes = { 0 },
     .track_atom_lst = NULL,
+    .prop_atom_lst = NULL,
+    .atoms = NULL,
+    .prop_handlers = NULL,
+    .nprop_handlers = 0,
+    .c2_ms = NULL,
 
 #ifdef CONFIG_DBUS
     .dbus_conn = NULL,
@@ -3574,8 +3756,11 @@ session_init(session_t *ps_old, int argc, char **argv) {
   ps->loop = EV_DEFAULT;
   pixman_region32_init(&ps->screen_reg);
   pixman_region32_init(&ps->all_damage);
+  pixman_region32_init(&ps->all_damage_other);
   for (int i = 0; i < CGLX_MAX_BUFFER_AGE; i ++)
     pixman_region32_init(&ps->all_damage_last[i]);
+  idmap_init(&ps->win_index);
+  idmap_init(&ps->client_index);
 
   ps_g = ps;
   ps->ignore_tail = &ps->ignore_head;
@@ -3597,6 +3782,7 @@ session_init(session_t *ps_old, int argc, char **argv) {
     XSetEventQueueOwner(ps->dpy, XCBOwnsEventQueue);
   }
   ps->c = XGetXCBConnection(ps->dpy);
+  ps->atoms = atom_new(ps->c);
   const xcb_query_extension_reply_t *ext_info;
 
   XSetErrorHandler(xerror);
@@ -3705,6 +3891,8 @@ session_init(session_t *ps_old, int argc, char **argv) {
   // Second pass
   get_cfg(ps, argc, argv, false);
 
+  c2_ms_build(ps);
+
   // Query X Shape
   ext_info = xcb_get_extension_data(ps->c, &xcb_shape_id);
   if (ext_info && ext_info->present) {
@@ -3789,6 +3977,7 @@ session_init(session_t *ps_old, int argc, char **argv) {
     exit(1);
 
   init_atoms(ps);
+  init_prop_handlers(ps);
 
   {
     xcb_render_create_picture_value_list_t pa = {
@@ -3856,11 +4045,25 @@ session_init(session_t *ps_old, int argc, char **argv) {
       nchildren = 0;
     }
 
+    // Send the requests for all windows first, then collect the replies,
+    // so adopting N windows costs about one round trip instead of N
+    auto reqs = ccalloc(max_i(nchildren, 1), win_add_req_t);
+    for (int i = 0; i < nchildren; i++)
+      reqs[i] = add_win_request(ps, children[i]);
+
+    Window prev = XCB_NONE;
     for (int i = 0; i < nchildren; i++) {
-      add_win(ps, children[i], i ? children[i-1] : XCB_NONE);
+      if (add_win_finish(ps, &reqs[i], prev))
+        prev = reqs[i].id;
     }
 
+    free(reqs);
     free(reply);
+
+#ifdef DEBUG_TIMING
+    print_timestamp(ps);
+    printf_dbgf("(): %d windows adopted.\n", nchildren);
+#endif
   }
 
   if (ps->o.track_focus) {
@@ -3944,6 +4147,9 @@ session_destroy(session_t *ps) {
     }
 
     ps->list = NULL;
+    ps->list_tail = NULL;
+    idmap_deinit(&ps->win_index);
+    idmap_deinit(&ps->client_index);
   }
 
   // Free blacklists
@@ -3965,8 +4171,24 @@ session_destroy(session_t *ps) {
     }
 
     ps->track_atom_lst = NULL;
+
+    for (latom_t *this = ps->prop_atom_lst; this; this = next) {
+      next = this->next;
+      free(this);
+    }
+
+    ps->prop_atom_lst = NULL;
   }
 
+  c2_ms_free(ps);
+
+  free(ps->prop_handlers);
+  ps->prop_handlers = NULL;
+  ps->nprop_handlers = 0;
+
+  atom_free(ps->atoms);
+  ps->atoms = NULL;
+
   // Free ignore linked list
   {
     ignore_t *next = NULL;
@@ -3996,6 +4218,7 @@ session_destroy(session_t *ps) {
 
   pixman_region32_fini(&ps->screen_reg);
   pixman_region32_fini(&ps->all_damage);
+  pixman_region32_fini(&ps->all_damage_other);
   for (int i = 0; i < CGLX_MAX_BUFFER_AGE; ++i)
     pixman_region32_fini(&ps->all_damage_last[i]);
   free(ps->expose_rects);
@@ -45,6 +45,8 @@
 
 void add_damage(session_t *ps, const region_t *damage);
 
+void queue_redraw(session_t *ps);
+
 long determine_evmask(session_t *ps, Window wid, win_evmode_t mode);
 
 xcb_window_t
@@ -214,6 +214,58 @@ parse_conv_kern_lst(session_t *ps, const char *src, xcb_render_fixed_t **dest, i
   return true;
 }
 
+/**
+ * Split a list of one separable blur kernel into a horizontal and a vertical
+ * pass, taking w+h samples per pixel instead of w*h.
+ *
+ * The center element of a kernel isn't part of it, it's taken as 1 here. The
+ * kernel is separable if every element is the product of the elements in the
+ * center row and the center column in line with it.
+ *
+ * @return the sum of the elements of the kernel if it's split, 0 otherwise
+ */
+double
+split_conv_kern_lst(xcb_render_fixed_t **kerns, int max) {
+  // Room for the two passes and the terminating NULL
+  if (max < 3 || !kerns[0] || kerns[1])
+    return 0;
+
+  xcb_render_fixed_t *kern = kerns[0];
+  const int wid = XFIXED_TO_DOUBLE(kern[0]), hei = XFIXED_TO_DOUBLE(kern[1]);
+  const int cx = wid / 2, cy = hei / 2;
+  if (wid == 1 || hei == 1)
+    return 0;
+
+#define P_ELEM(x, y) ((x) == cx && (y) == cy ? 1.0 : \
+    XFIXED_TO_DOUBLE(kern[2 + (y) * wid + (x)]))
+  for (int y = 0; y < hei; ++y)
+    for (int x = 0; x < wid; ++x)
+      if (fabs(P_ELEM(x, y) - P_ELEM(x, cy) * P_ELEM(cx, y)) > 1e-4)
+        return 0;
+
+  auto horz = ccalloc(wid + 2, xcb_render_fixed_t);
+  auto vert = ccalloc(hei + 2, xcb_render_fixed_t);
+  horz[0] = DOUBLE_TO_XFIXED(wid);
+  horz[1] = DOUBLE_TO_XFIXED(1);
+  vert[0] = DOUBLE_TO_XFIXED(1);
+  vert[1] = DOUBLE_TO_XFIXED(hei);
+  double sum_horz = 0, sum_vert = 0;
+  for (int x = 0; x < wid; ++x) {
+    horz[2 + x] = x == cx ? DOUBLE_TO_XFIXED(0) : kern[2 + cy * wid + x];
+    sum_horz += P_ELEM(x, cy);
+  }
+  for (int y = 0; y < hei; ++y) {
+    vert[2 + y] = y == cy ? DOUBLE_TO_XFIXED(0) : kern[2 + y * wid + cx];
+    sum_vert += P_ELEM(cx, y);
+  }
+#undef P_ELEM
+
+  free(kern);
+  kerns[0] = horz;
+  kerns[1] = vert;
+  return sum_horz * sum_vert;
+}
+
 /**
  * Parse a X geometry.
  *
@@ -16,6 +16,7 @@ const char *parse_matrix_readnum(const char *, double *);
 xcb_render_fixed_t *parse_matrix(session_t *, const char *, const char **);
 xcb_render_fixed_t *parse_conv_kern(session_t *, const char *, const char **);
 bool parse_conv_kern_lst(session_t *, const char *, xcb_render_fixed_t **, int);
+double split_conv_kern_lst(xcb_render_fixed_t **, int);
 bool parse_geometry(session_t *, const char *, region_t *);
 bool parse_rule_opacity(session_t *, const char *);
 
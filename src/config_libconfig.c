@@ -325,12 +325,22 @@ void parse_config_libconfig(session_t *ps, bool *shadow_enable,
   if (config_lookup_string(&cfg, "blur-kern", &sval)
       && !parse_conv_kern_lst(ps, sval, ps->o.blur_kerns, MAX_BLUR_PASS))
     exit(1);
+  // --blur-method
+  if (config_lookup_string(&cfg, "blur-method", &sval)
+      && !parse_blur_method(ps, sval))
+    exit(1);
+  // --blur-strength
+  config_lookup_int(&cfg, "blur-strength", &ps->o.blur_strength);
   // --resize-damage
   config_lookup_int(&cfg, "resize-damage", &ps->o.resize_damage);
   // --glx-no-stencil
   lcfg_lookup_bool(&cfg, "glx-no-stencil", &ps->o.glx_no_stencil);
   // --glx-no-rebind-pixmap
   lcfg_lookup_bool(&cfg, "glx-no-rebind-pixmap", &ps->o.glx_no_rebind_pixmap);
+  // --glx-analytic-shadow
+  lcfg_lookup_bool(&cfg, "glx-analytic-shadow", &ps->o.glx_analytic_shadow);
+  // --glx-front-to-back
+  lcfg_lookup_bool(&cfg, "glx-front-to-back", &ps->o.glx_front_to_back);
   // --glx-swap-method
   if (config_lookup_string(&cfg, "glx-swap-method", &sval)
       && !parse_glx_swap_method(ps, sval))
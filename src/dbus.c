@@ -926,6 +926,12 @@ cdbus_process_opts_get(session_t *ps, DBusMessage *msg) {
   cdbus_m_opts_get_do(shadow_opacity, cdbus_reply_double);
   cdbus_m_opts_get_stub(clear_shadow, cdbus_reply_bool, true);
   cdbus_m_opts_get_do(xinerama_shadow_crop, cdbus_reply_bool);
+  cdbus_m_opts_get_stub(shadow_cache_hits, cdbus_reply_uint32,
+      ps->shadow_cache.hits);
+  cdbus_m_opts_get_stub(shadow_cache_misses, cdbus_reply_uint32,
+      ps->shadow_cache.misses);
+  cdbus_m_opts_get_stub(shadow_cache_hit_rate, cdbus_reply_double,
+      shadow_cache_hit_rate(&ps->shadow_cache));
 
   cdbus_m_opts_get_do(fade_delta, cdbus_reply_int32);
   cdbus_m_opts_get_do(fade_in_step, cdbus_reply_int32);
@@ -935,6 +941,12 @@ cdbus_process_opts_get(session_t *ps, DBusMessage *msg) {
   cdbus_m_opts_get_do(blur_background, cdbus_reply_bool);
   cdbus_m_opts_get_do(blur_background_frame, cdbus_reply_bool);
   cdbus_m_opts_get_do(blur_background_fixed, cdbus_reply_bool);
+  if (!strcmp("blur_method", target)) {
+    assert(ps->o.blur_method < sizeof(BLUR_METHOD_STRS) / sizeof(BLUR_METHOD_STRS[0]));
+    cdbus_reply_string(ps, msg, BLUR_METHOD_STRS[ps->o.blur_method]);
+    return true;
+  }
+  cdbus_m_opts_get_do(blur_strength, cdbus_reply_int32);
 
   cdbus_m_opts_get_do(inactive_dim, cdbus_reply_double);
   cdbus_m_opts_get_do(inactive_dim_fixed, cdbus_reply_bool);
@@ -948,6 +960,8 @@ cdbus_process_opts_get(session_t *ps, DBusMessage *msg) {
   cdbus_m_opts_get_stub(glx_copy_from_front, cdbus_reply_bool, false);
   cdbus_m_opts_get_do(glx_no_stencil, cdbus_reply_bool);
   cdbus_m_opts_get_do(glx_no_rebind_pixmap, cdbus_reply_bool);
+  cdbus_m_opts_get_do(glx_analytic_shadow, cdbus_reply_bool);
+  cdbus_m_opts_get_do(glx_front_to_back, cdbus_reply_bool);
   cdbus_m_opts_get_do(glx_swap_method, cdbus_reply_int32);
 #endif
 
@@ -12,12 +12,17 @@ void print_diagnostics(session_t *ps) {
 	printf("* Shape: %s\n", ps->shape_exists ? "Yes" : "No");
 	printf("* XRandR: %s\n", ps->randr_exists ? "Yes" : "No");
 	printf("* Present: %s\n", ps->present_exists ? "Present" : "Not Present");
+	printf("* MIT-SHM: %s\n", ps->shm ? "Yes" : "No");
 	printf("\n### Misc:\n\n");
 	printf("* Use Overlay: %s\n", ps->overlay != XCB_NONE ? "Yes" : "No");
 #ifdef __FAST_MATH__
 	printf("* Fast Math: Yes\n");
 #endif
 	printf("* Config file used: %s\n", ps->o.config_file ?: "None");
+	printf("\n### Shadow cache:\n\n");
+	printf("* Budget: %d KiB\n", SHADOW_CACHE_BUDGET / 1024);
+	// Nothing has been painted yet, the statistics of a running instance
+	// are the D-Bus options shadow_cache_hits/misses/hit_rate
 }
 
 // vim: set noet sw=8 ts=8 :
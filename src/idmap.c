@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "idmap.h"
+
+#define IDMAP_MIN_CAPACITY 64
+
+void idmap_init(idmap_t *map) {
+  map->capacity = IDMAP_MIN_CAPACITY;
+  map->count = 0;
+  map->entries = ccalloc(map->capacity, struct idmap_entry);
+}
+
+void idmap_deinit(idmap_t *map) {
+  free(map->entries);
+  map->entries = NULL;
+  map->capacity = 0;
+  map->count = 0;
+}
+
+static void
+idmap_insert_slot(idmap_t *map, uint32_t key, void *value) {
+  unsigned int i = idmap_slot(key, map->capacity);
+  while (map->entries[i].key && map->entries[i].key != key)
+    i = (i + 1) & (map->capacity - 1);
+  if (!map->entries[i].key)
+    map->count++;
+  map->entries[i].key = key;
+  map->entries[i].value = value;
+}
+
+/// Double the table size, and reinsert everything
+static void
+idmap_grow(idmap_t *map) {
+  struct idmap_entry *old = map->entries;
+  unsigned int old_capacity = map->capacity;
+
+  map->capacity *= 2;
+  map->count = 0;
+  map->entries = ccalloc(map->capacity, struct idmap_entry);
+  for (unsigned int i = 0; i < old_capacity; i++)
+    if (old[i].key)
+      idmap_insert_slot(map, old[i].key, old[i].value);
+  free(old);
+}
+
+void idmap_set(idmap_t *map, uint32_t key, void *value) {
+  assert(key);
+  // Keep the load factor under 1/2, so probe sequences stay short
+  if ((map->count + 1) * 2 > map->capacity)
+    idmap_grow(map);
+  idmap_insert_slot(map, key, value);
+}
+
+bool idmap_remove(idmap_t *map, uint32_t key, const void *value) {
+  if (!key || !map->count)
+    return false;
+
+  const unsigned int mask = map->capacity - 1;
+  unsigned int i = idmap_slot(key, map->capacity);
+  while (map->entries[i].key != key) {
+    if (!map->entries[i].key)
+      return false;
+    i = (i + 1) & mask;
+  }
+  if (value && map->entries[i].value != value)
+    return false;
+
+  // Shift back entries following the removed one, if their probe sequence
+  // passes through the hole
+  for (unsigned int j = (i + 1) & mask; map->entries[j].key; j = (j + 1) & mask) {
+    unsigned int home = idmap_slot(map->entries[j].key, map->capacity);
+    // Entry j can fill the hole at i if i lies cyclically in [home, j)
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      map->entries[i] = map->entries[j];
+      i = j;
+    }
+  }
+  map->entries[i].key = 0;
+  map->entries[i].value = NULL;
+  map->count--;
+  return true;
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "compiler.h"
+
+/// An open-addressing hash table, mapping X resource IDs to pointers.
+///
+/// Collisions are resolved with linear probing, and removal shifts the
+/// following entries back, so there are no tombstones. ID 0 (None) is never
+/// a valid X resource, and is used to mark an empty slot.
+struct idmap_entry {
+  uint32_t key;
+  void *value;
+};
+
+typedef struct idmap {
+  struct idmap_entry *entries;
+  /// Number of slots, always a power of 2
+  unsigned int capacity;
+  /// Number of slots in use
+  unsigned int count;
+} idmap_t;
+
+void idmap_init(idmap_t *map);
+void idmap_deinit(idmap_t *map);
+
+/// Insert or replace the value associated with `key`
+void idmap_set(idmap_t *map, uint32_t key, void *value);
+
+/// Remove `key` from the map, but only if it is associated with `value`.
+/// Pass NULL as `value` to remove `key` unconditionally.
+///
+/// @return whether an entry was removed
+bool idmap_remove(idmap_t *map, uint32_t key, const void *value);
+
+static inline unsigned int attr_const
+idmap_slot(uint32_t key, unsigned int capacity) {
+  // Fibonacci hashing. Resource IDs are handed out sequentially within a
+  // client's range, so spread them out before masking.
+  uint32_t h = key * UINT32_C(2654435769);
+  return (h ^ (h >> 16)) & (capacity - 1);
+}
+
+/// Look up the value associated with `key`, NULL if there is none
+static inline void *
+idmap_get(const idmap_t *map, uint32_t key) {
+  if (!key || !map->count)
+    return NULL;
+
+  for (unsigned int i = idmap_slot(key, map->capacity); ;
+      i = (i + 1) & (map->capacity - 1)) {
+    const struct idmap_entry *e = &map->entries[i];
+    if (e->key == key)
+      return e->value;
+    if (!e->key)
+      return NULL;
+  }
+}
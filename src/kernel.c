@@ -25,11 +25,9 @@
 
 double sum_kernel(const conv *map, int x, int y, int width,
                                        int height) {
-	int fx, fy;
-	const double *g_data;
-	const double *g_line = map->data;
-	int g_size = map->size;
-	int center = g_size / 2;
+	const int g_size = map->size;
+	const int center = g_size / 2;
+	const int stride = g_size + 1;
 	int fx_start, fx_end;
 	int fy_start, fy_end;
 	double v;
@@ -58,32 +56,52 @@ double sum_kernel(const conv *map, int x, int y, int width,
 	if (fy_end > g_size)
 		fy_end = g_size;
 
-	g_line = g_line + fy_start * g_size + fx_start;
+	if (fx_start >= fx_end || fy_start >= fy_end)
+		return 0;
 
-	v = 0;
-
-	for (fy = fy_start; fy < fy_end; fy++) {
-		g_data = g_line;
-		g_line += g_size;
-
-		for (fx = fx_start; fx < fx_end; fx++) {
-			v += *g_data++;
-		}
-	}
+	v = map->sat[fy_end * stride + fx_end] - map->sat[fy_start * stride + fx_end] -
+	    map->sat[fy_end * stride + fx_start] + map->sat[fy_start * stride + fx_start];
 
+	// Rounding errors of the table can take the sum slightly out of range
 	if (v > 1)
 		v = 1;
+	if (v < 0)
+		v = 0;
 
 	return v;
 }
 
-static double attr_const gaussian(double r, double x, double y) {
+static double attr_const gaussian(double r, double x) {
 	// Formula can be found here:
 	// https://en.wikipedia.org/wiki/Gaussian_blur#Mathematics
 	// Except a special case for r == 0 to produce sharp shadows
 	if (r == 0)
 		return 1;
-	return exp(-0.5 * (x * x + y * y) / (r * r)) / (2 * M_PI * r * r);
+	return exp(-0.5 * (x * x) / (r * r)) / (sqrt(2 * M_PI) * r);
+}
+
+/// Allocate a kernel of the given size, with room for its summed-area table
+static conv *conv_new(int size) {
+	conv *c = cvalloc(sizeof(conv) + (size * size + (size + 1) * (size + 1)) *
+	                                     sizeof(double));
+	c->size = size;
+	c->sat = c->data + size * size;
+	return c;
+}
+
+/// Build the summed-area table of a kernel
+static void conv_build_sat(conv *c) {
+	const int size = c->size, stride = size + 1;
+	for (int x = 0; x < stride; x++)
+		c->sat[x] = 0;
+	for (int y = 0; y < size; y++) {
+		double row = 0;
+		c->sat[(y + 1) * stride] = 0;
+		for (int x = 0; x < size; x++) {
+			row += c->data[y * size + x];
+			c->sat[(y + 1) * stride + x + 1] = c->sat[y * stride + x + 1] + row;
+		}
+	}
 }
 
 conv *gaussian_kernel(double r) {
@@ -92,29 +110,24 @@ conv *gaussian_kernel(double r) {
 	int center = size / 2;
 	double t;
 
-	c = cvalloc(sizeof(conv) + size * size * sizeof(double));
-	c->size = size;
+	// A 2D gaussian is the product of two 1D gaussians, so the kernel is the
+	// outer product of a normalized 1D kernel with itself
+	double *g = ccalloc(size, double);
 	t = 0.0;
-
-	/*printf_errf("(): %f", r);*/
-	for (int y = 0; y < size; y++) {
-		for (int x = 0; x < size; x++) {
-			double g = gaussian(r, x - center, y - center);
-			t += g;
-			c->data[y * size + x] = g;
-			/*printf("%f ", c->data[y*size+x]);*/
-		}
-		/*printf("\n");*/
+	for (int i = 0; i < size; i++) {
+		g[i] = gaussian(r, i - center);
+		t += g[i];
 	}
+	for (int i = 0; i < size; i++)
+		g[i] /= t;
 
-	for (int y = 0; y < size; y++) {
-		for (int x = 0; x < size; x++) {
-			c->data[y * size + x] /= t;
-			/*printf("%f ", c->data[y*size+x]);*/
-		}
-		/*printf("\n");*/
-	}
+	c = conv_new(size);
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)
+			c->data[y * size + x] = g[y] * g[x];
+	free(g);
 
+	conv_build_sat(c);
 	return c;
 }
 
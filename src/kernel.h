@@ -8,12 +8,16 @@
 
 typedef struct conv {
 	int size;
+	/// Summed-area table of the kernel, (size + 1) x (size + 1). Element
+	/// (x, y) is the sum of all elements of data above and to the left of
+	/// (x, y), exclusive. Points into the same allocation as the kernel.
+	double *sat;
 	double data[];
 } conv;
 
 /// Calculate the sum of a rectangle part of the convolution kernel
 /// the rectangle is defined by top left (x, y), and a size (width x height)
-double attr_const sum_kernel(const conv *map, int x, int y, int width, int height);
+double attr_pure sum_kernel(const conv *map, int x, int y, int width, int height);
 
 /// Create a kernel with gaussian distribution of radius r
 conv *gaussian_kernel(double r);
@@ -15,6 +15,17 @@
 
 #include "opengl.h"
 
+/// Floats of a vertex in the vertex buffer, its position and its texture
+/// coordinates
+#define GLX_VERTEX_FLOATS 5
+#define GLX_VERTEX_STRIDE (GLX_VERTEX_FLOATS * sizeof(GLfloat))
+/// Floats of a vertex of analytic shadows, its position, the rectangle
+/// casting the shadow and the shadow color
+#define GLX_SHADOW_VERTEX_FLOATS 11
+#define GLX_SHADOW_VERTEX_STRIDE (GLX_SHADOW_VERTEX_FLOATS * sizeof(GLfloat))
+/// Vertices the vertex buffer has room for at first
+#define GLX_VBO_MIN_SIZE 4096
+
 static inline int
 glx_cmp_fbconfig_cmpattr(session_t *ps,
     const glx_fbconfig_t *pfbc_a, const glx_fbconfig_t *pfbc_b,
@@ -213,6 +224,121 @@ glx_debug_msg_callback(GLenum source, GLenum type,
 }
 #endif
 
+/**
+ * Create the vertex buffer quads are painted from. It stays bound, with the
+ * vertex arrays pointing into it.
+ */
+static bool
+glx_init_vbo(session_t *ps) {
+  glx_session_t *psglx = ps->psglx;
+  glGenBuffers(1, &psglx->vbo);
+  if (!psglx->vbo) {
+    printf_errf("(): Failed to generate vertex buffer.");
+    return false;
+  }
+  psglx->vbo_size = GLX_VBO_MIN_SIZE;
+  psglx->vbo_used = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, psglx->vbo);
+  glBufferData(GL_ARRAY_BUFFER, psglx->vbo_size * GLX_VERTEX_STRIDE, NULL,
+      GL_STREAM_DRAW);
+
+  glVertexPointer(3, GL_FLOAT, GLX_VERTEX_STRIDE, (void *) 0);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  // The second texture stage is only used by glx_render(), which enables its
+  // coordinate array when needed
+  glClientActiveTexture(GL_TEXTURE1);
+  glTexCoordPointer(2, GL_FLOAT, GLX_VERTEX_STRIDE,
+      (void *) (3 * sizeof(GLfloat)));
+  glClientActiveTexture(GL_TEXTURE0);
+  glTexCoordPointer(2, GL_FLOAT, GLX_VERTEX_STRIDE,
+      (void *) (3 * sizeof(GLfloat)));
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+  return true;
+}
+
+/**
+ * Initialize the built-in GLSL programs painting windows.
+ *
+ * They apply opacity, frame opacity, color inversion and dimming to the
+ * premultiplied window contents in one pass. A dimmed window is painted as
+ * if a black rectangle of the dim opacity was painted over it.
+ *
+ * Inversion is done on the premultiplied color as A - C, which is what the
+ * fixed-function texture combiners in glx_render() compute for ARGB windows
+ * (GL_SUBTRACT of GL_SRC_ALPHA and GL_SRC_COLOR). Opaque windows sample an
+ * alpha of 1, so this is the same 1 - C of the non-ARGB combiners. Inverting
+ * as (1 - C) * A instead would multiply premultiplied color by alpha a
+ * second time and darken translucent pixels.
+ */
+static void
+glx_init_win_prog(session_t *ps) {
+  static const char *FRAG_SHADER_WIN =
+    "#version 110\n"
+    "%s"
+    "uniform float opacity;\n"
+    "uniform float frame_opacity;\n"
+    "uniform vec4 body;\n"
+    "uniform float root_height;\n"
+    "uniform float dim;\n"
+    "uniform bool invert_color;\n"
+    "uniform %s tex;\n"
+    "\n"
+    "void main() {\n"
+    "  vec4 c = %s(tex, gl_TexCoord[0].xy);\n"
+    "  if (invert_color)\n"
+    "    c = vec4(c.aaa - c.rgb, c.a);\n"
+    "  vec2 p = vec2(gl_FragCoord.x, root_height - gl_FragCoord.y);\n"
+    "  if (all(greaterThanEqual(p, body.xy)) && all(lessThan(p, body.zw)))\n"
+    "    c *= opacity;\n"
+    "  else\n"
+    "    c *= opacity * frame_opacity;\n"
+    "  gl_FragColor = vec4(c.rgb * (1.0 - dim), c.a + dim * (1.0 - c.a));\n"
+    "}\n";
+
+  for (int i = 0; i < 2; ++i) {
+    const bool rect = i;
+    if (rect && !glx_hasglext(ps, "GL_ARB_texture_rectangle"))
+      continue;
+
+    const char *extension = (rect ?
+        "#extension GL_ARB_texture_rectangle : require\n": "");
+    const char *sampler_type = (rect ? "sampler2DRect": "sampler2D");
+    const char *texture_func = (rect ? "texture2DRect": "texture2D");
+    const size_t len = strlen(FRAG_SHADER_WIN) + strlen(extension) +
+      strlen(sampler_type) + strlen(texture_func) + 1;
+    char *shader_str = ccalloc(len, char);
+    sprintf(shader_str, FRAG_SHADER_WIN, extension, sampler_type,
+        texture_func);
+    assert(strlen(shader_str) < len);
+    glx_win_prog_t *pprogram = &ps->psglx->win_progs[i];
+    pprogram->prog = glx_create_program_from_str(NULL, shader_str);
+    free(shader_str);
+    if (!pprogram->prog) {
+      printf_errf("(): Failed to create window GLSL program, painting "
+          "windows with the fixed-function pipeline.");
+      continue;
+    }
+
+#define P_GET_UNIFM_LOC(name, target) { \
+      pprogram->target = glGetUniformLocation(pprogram->prog, name); \
+      if (pprogram->target < 0) { \
+        printf_errf("(): Failed to get location of uniform '" name "'. Might be troublesome."); \
+      } \
+    }
+    P_GET_UNIFM_LOC("opacity", unifm_opacity);
+    P_GET_UNIFM_LOC("frame_opacity", unifm_frame_opacity);
+    P_GET_UNIFM_LOC("body", unifm_body);
+    P_GET_UNIFM_LOC("root_height", unifm_root_height);
+    P_GET_UNIFM_LOC("dim", unifm_dim);
+    P_GET_UNIFM_LOC("invert_color", unifm_invert_color);
+    P_GET_UNIFM_LOC("tex", unifm_tex);
+#undef P_GET_UNIFM_LOC
+  }
+
+  glx_check_err(ps);
+}
+
 /**
  * Initialize OpenGL.
  */
@@ -268,6 +394,14 @@ glx_init(session_t *ps, bool need_render) {
       ppass->unifm_factor_center = -1;
       ppass->unifm_offset_x = -1;
       ppass->unifm_offset_y = -1;
+      ppass->unifm_tex_max = -1;
+    }
+    glx_kawase_pass_t *pkawase[] = {
+      &ps->psglx->kawase_down, &ps->psglx->kawase_up };
+    for (int i = 0; i < 2; ++i) {
+      pkawase[i]->unifm_pixel = -1;
+      pkawase[i]->unifm_offset = -1;
+      pkawase[i]->unifm_tex_max = -1;
     }
   }
 
@@ -366,10 +500,38 @@ glx_init(session_t *ps, bool need_render) {
     }
   }
 
+  // Importing X Sync fences lets the GPU wait for X rendering to a pixmap
+  // before binding it, see glx_sync_pixmap(). It's optional, so look the
+  // extensions up quietly
+  if (need_render && ps->xsync_exists) {
+    const char *gl_exts = (const char *) glGetString(GL_EXTENSIONS);
+    if (gl_exts && wd_is_in_str(gl_exts, "GL_ARB_sync")
+        && wd_is_in_str(gl_exts, "GL_EXT_x11_sync_object")) {
+      psglx->glWaitSyncProc = (f_WaitSync)
+        glXGetProcAddress((const GLubyte *) "glWaitSync");
+      psglx->glDeleteSyncProc = (f_DeleteSync)
+        glXGetProcAddress((const GLubyte *) "glDeleteSync");
+      psglx->glFenceSyncProc = (f_FenceSync)
+        glXGetProcAddress((const GLubyte *) "glFenceSync");
+      psglx->glClientWaitSyncProc = (f_ClientWaitSync)
+        glXGetProcAddress((const GLubyte *) "glClientWaitSync");
+      if (psglx->glWaitSyncProc && psglx->glDeleteSyncProc
+          && psglx->glFenceSyncProc && psglx->glClientWaitSyncProc)
+        psglx->glImportSyncEXT = (f_ImportSyncEXT)
+          glXGetProcAddress((const GLubyte *) "glImportSyncEXT");
+    }
+  }
+
   // Acquire FBConfigs
   if (need_render && !glx_update_fbconfig(ps))
     goto glx_init_end;
 
+  if (need_render && !glx_init_vbo(ps))
+    goto glx_init_end;
+
+  if (need_render)
+    glx_init_win_prog(ps);
+
   // Render preparations
   if (need_render) {
     glx_on_root_change(ps);
@@ -438,6 +600,23 @@ glx_destroy(session_t *ps) {
       glDeleteProgram(ppass->prog);
   }
 
+  if (ps->psglx->vbo)
+    glDeleteBuffers(1, &ps->psglx->vbo);
+  free(ps->psglx->quads);
+  free(ps->psglx->shadow_verts);
+
+  if (ps->psglx->kawase_down.prog)
+    glDeleteProgram(ps->psglx->kawase_down.prog);
+  if (ps->psglx->kawase_up.prog)
+    glDeleteProgram(ps->psglx->kawase_up.prog);
+
+  if (ps->psglx->shadow_prog.prog)
+    glDeleteProgram(ps->psglx->shadow_prog.prog);
+
+  for (int i = 0; i < 2; ++i)
+    if (ps->psglx->win_progs[i].prog)
+      glDeleteProgram(ps->psglx->win_progs[i].prog);
+
   glx_free_prog_main(ps, &ps->o.glx_prog_win);
 
   glx_check_err(ps);
@@ -495,11 +674,125 @@ glx_on_root_change(session_t *ps) {
   glLoadIdentity();
 }
 
+/// Downsampling levels and sample offset of the dual Kawase blur, by strength
+static const struct {
+  int levels;
+  GLfloat offset;
+} KAWASE_STRENGTHS[MAX_BLUR_STRENGTH] = {
+  { 1, 1.25f }, { 1, 2.25f }, { 2, 1.5f }, { 2, 2.5f }, { 3, 1.75f },
+  { 3, 2.75f }, { 4, 2.0f }, { 4, 3.0f }, { 5, 2.25f }, { 5, 3.25f },
+};
+
+/**
+ * Get how far the dual Kawase blur spreads a pixel, at the configured
+ * strength.
+ */
+int
+glx_kawase_radius(session_t *ps) {
+  const int levels = KAWASE_STRENGTHS[ps->o.blur_strength - 1].levels;
+  const GLfloat offset = KAWASE_STRENGTHS[ps->o.blur_strength - 1].offset;
+  // Each pass samples a texel offset texels away and its neighbours, a
+  // texel of a level covering twice the pixels of one of the level above
+  return ceil(3.0 * (offset + 1.0) * ((1 << levels) - 1));
+}
+
+/**
+ * Initialize the GLSL programs of the dual Kawase blur.
+ *
+ * The downsampling pass averages the texels around a point and four points
+ * diagonally around it, the upsampling pass eight points on a ring around it.
+ * Samples are kept inside the part of the texture in use.
+ */
+static bool
+glx_init_kawase(session_t *ps) {
+  // Try to generate a framebuffer
+  GLuint fbo = 0;
+  glGenFramebuffers(1, &fbo);
+  if (!fbo) {
+    printf_errf("(): Failed to generate Framebuffer. Cannot do "
+        "dual Kawase blur with GLX backend.");
+    return false;
+  }
+  glDeleteFramebuffers(1, &fbo);
+
+  static const char *FRAG_SHADER_KAWASE =
+    "#version 110\n"
+    "%s"
+    "uniform vec2 pixel;\n"
+    "uniform float offset;\n"
+    "uniform vec2 tex_max;\n"
+    "uniform %s tex_scr;\n"
+    "\n"
+    "vec4 tap(vec2 d) {\n"
+    "  return %s(tex_scr, clamp(gl_TexCoord[0].xy + d, pixel * 0.5,\n"
+    "      tex_max - pixel * 0.5));\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "%s"
+    "}\n";
+  static const char *FRAG_SHADER_KAWASE_DOWN =
+    "  vec2 d = pixel * offset;\n"
+    "  gl_FragColor = (tap(vec2(0.0)) * 4.0 + tap(d) + tap(-d)\n"
+    "      + tap(vec2(d.x, -d.y)) + tap(vec2(-d.x, d.y))) / 8.0;\n";
+  static const char *FRAG_SHADER_KAWASE_UP =
+    "  vec2 d = pixel * offset * 0.5;\n"
+    "  gl_FragColor = (tap(vec2(-2.0 * d.x, 0.0)) + tap(vec2(2.0 * d.x, 0.0))\n"
+    "      + tap(vec2(0.0, -2.0 * d.y)) + tap(vec2(0.0, 2.0 * d.y))\n"
+    "      + (tap(d) + tap(-d) + tap(vec2(d.x, -d.y)) + tap(vec2(-d.x, d.y)))\n"
+    "      * 2.0) / 12.0;\n";
+
+  const bool use_texture_rect = !ps->psglx->has_texture_non_power_of_two;
+  const char *extension = (use_texture_rect ?
+      "#extension GL_ARB_texture_rectangle : require\n": "");
+  const char *sampler_type = (use_texture_rect ?
+      "sampler2DRect": "sampler2D");
+  const char *texture_func = (use_texture_rect ?
+      "texture2DRect": "texture2D");
+
+  glx_kawase_pass_t *ppasses[] = {
+    &ps->psglx->kawase_down, &ps->psglx->kawase_up };
+  const char *bodies[] = { FRAG_SHADER_KAWASE_DOWN, FRAG_SHADER_KAWASE_UP };
+  for (int i = 0; i < 2; ++i) {
+    glx_kawase_pass_t *ppass = ppasses[i];
+    const size_t len = strlen(FRAG_SHADER_KAWASE) + strlen(extension) +
+      strlen(sampler_type) + strlen(texture_func) + strlen(bodies[i]) + 1;
+    char *shader_str = ccalloc(len, char);
+    sprintf(shader_str, FRAG_SHADER_KAWASE, extension, sampler_type,
+        texture_func, bodies[i]);
+    assert(strlen(shader_str) < len);
+    ppass->prog = glx_create_program_from_str(NULL, shader_str);
+    free(shader_str);
+    if (!ppass->prog) {
+      printf_errf("(): Failed to create GLSL program.");
+      return false;
+    }
+
+#define P_GET_UNIFM_LOC(name, target) { \
+      ppass->target = glGetUniformLocation(ppass->prog, name); \
+      if (ppass->target < 0) { \
+        printf_errf("(): Failed to get location of %d-th uniform '" name "'. Might be troublesome.", i); \
+      } \
+    }
+    P_GET_UNIFM_LOC("pixel", unifm_pixel);
+    P_GET_UNIFM_LOC("offset", unifm_offset);
+    P_GET_UNIFM_LOC("tex_max", unifm_tex_max);
+#undef P_GET_UNIFM_LOC
+  }
+
+  glx_check_err(ps);
+
+  return true;
+}
+
 /**
  * Initialize GLX blur filter.
  */
 bool
 glx_init_blur(session_t *ps) {
+  if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE)
+    return glx_init_kawase(ps);
+
   assert(ps->o.blur_kerns[0]);
 
   // Allocate PBO if more than one blur kernel is present
@@ -527,12 +820,21 @@ glx_init_blur(session_t *ps) {
       "uniform float offset_x;\n"
       "uniform float offset_y;\n"
       "uniform float factor_center;\n"
+      "uniform vec2 tex_max;\n"
       "uniform %s tex_scr;\n"
       "\n"
+      "// The texture may be larger than the area copied into it, taps are\n"
+      "// kept inside the area\n"
+      "vec2 tap(int x, int y) {\n"
+      "  vec2 d = vec2(offset_x, offset_y);\n"
+      "  return clamp(gl_TexCoord[0].xy + d * vec2(float(x), float(y)),\n"
+      "      d * 0.5, tex_max - d * 0.5);\n"
+      "}\n"
+      "\n"
       "void main() {\n"
       "  vec4 sum = vec4(0.0, 0.0, 0.0, 0.0);\n";
     static const char *FRAG_SHADER_BLUR_ADD =
-      "  sum += float(%.7g) * %s(tex_scr, vec2(gl_TexCoord[0].x + offset_x * float(%d), gl_TexCoord[0].y + offset_y * float(%d)));\n";
+      "  sum += float(%.7g) * %s(tex_scr, tap(%d, %d));\n";
     static const char *FRAG_SHADER_BLUR_ADD_GPUSHADER4 =
       "  sum += float(%.7g) * %sOffset(tex_scr, vec2(gl_TexCoord[0].x, gl_TexCoord[0].y), ivec2(%d, %d));\n";
     static const char *FRAG_SHADER_BLUR_SUFFIX =
@@ -628,6 +930,7 @@ glx_init_blur(session_t *ps) {
       if (!ps->o.glx_use_gpushader4) {
         P_GET_UNIFM_LOC("offset_x", unifm_offset_x);
         P_GET_UNIFM_LOC("offset_y", unifm_offset_y);
+        P_GET_UNIFM_LOC("tex_max", unifm_tex_max);
       }
 
 #undef P_GET_UNIFM_LOC
@@ -678,6 +981,147 @@ glx_load_prog_main(session_t *ps,
   return true;
 }
 
+/**
+ * Initialize the GLSL program drawing shadows analytically.
+ *
+ * A shadow is the window rectangle convolved with the shadow kernel. The
+ * kernel is a gaussian truncated at the shadow radius, and separable, so the
+ * shadow at a point is the product of two differences of the truncated
+ * gaussian's CDF, which is evaluated with an approximation of erf().
+ *
+ * The rectangle casting the shadow and the premultiplied shadow color come
+ * with the vertices, as texture coordinates and vertex color, so the shadows
+ * of many windows are painted with one draw call.
+ */
+bool
+glx_init_shadow(session_t *ps) {
+  static const char *FRAG_SHADER_SHADOW =
+    "#version 110\n"
+    "uniform float root_height;\n"
+    "uniform float range;\n"
+    "uniform float scale;\n"
+    "uniform float norm;\n"
+    "\n"
+    // Abramowitz and Stegun 7.1.26, max error 1.5e-7
+    "float erf_approx(float x) {\n"
+    "  float t = 1.0 / (1.0 + 0.3275911 * abs(x));\n"
+    "  float p = ((((1.061405429 * t - 1.453152027) * t + 1.421413741) * t\n"
+    "      - 0.284496736) * t + 0.254829592) * t;\n"
+    "  return sign(x) * (1.0 - p * exp(-x * x));\n"
+    "}\n"
+    "\n"
+    "float cdf(float x) {\n"
+    "  return erf_approx(clamp(x, -range, range) * scale);\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "  vec4 rect = gl_TexCoord[0];\n"
+    "  vec2 p = vec2(gl_FragCoord.x, root_height - gl_FragCoord.y);\n"
+    "  float a = (cdf(rect.z - p.x) - cdf(rect.x - p.x)) * norm;\n"
+    "  float b = (cdf(rect.w - p.y) - cdf(rect.y - p.y)) * norm;\n"
+    "  gl_FragColor = gl_Color * (a * b);\n"
+    "}\n";
+
+  glx_shadow_prog_t *pprogram = &ps->psglx->shadow_prog;
+  pprogram->prog = glx_create_program_from_str(NULL, FRAG_SHADER_SHADOW);
+  if (!pprogram->prog) {
+    printf_errf("(): Failed to create GLSL program.");
+    return false;
+  }
+
+#define P_GET_UNIFM_LOC(name, target) { \
+      pprogram->target = glGetUniformLocation(pprogram->prog, name); \
+      if (pprogram->target < 0) { \
+        printf_errf("(): Failed to get location of uniform '" name "'. Might be troublesome."); \
+      } \
+    }
+  P_GET_UNIFM_LOC("root_height", unifm_root_height);
+#undef P_GET_UNIFM_LOC
+
+  // The kernel covers the pixels within the radius, a radius of 0 is a
+  // sharp shadow, a step function
+  const double r = ps->o.shadow_radius;
+  const double range = r + 0.5;
+  const double scale = r > 0 ? 1.0 / (sqrt(2) * r) : 1e4;
+  glUseProgram(pprogram->prog);
+  glUniform1f(glGetUniformLocation(pprogram->prog, "range"), range);
+  glUniform1f(glGetUniformLocation(pprogram->prog, "scale"), scale);
+  glUniform1f(glGetUniformLocation(pprogram->prog, "norm"),
+      0.5 / erf(range * scale));
+  glUseProgram(0);
+
+  glx_check_err(ps);
+
+  return true;
+}
+
+/**
+ * Make the GPU wait until the X server has carried out the requests sent so
+ * far that render to a texture's pixmap.
+ *
+ * Unlike xr_sync() this doesn't need a round trip: the fence is triggered
+ * after those requests, and only GL commands issued later wait for it.
+ */
+static void
+glx_sync_pixmap(session_t *ps, glx_texture_t *ptex) {
+  if (!ps->psglx->glImportSyncEXT)
+    return;
+
+  glx_session_t *psglx = ps->psglx;
+  const int i = ptex->fence_next;
+  ptex->fence_next = (i + 1) % GLX_PIXMAP_FENCES;
+
+  // A fence may only be reset once the GPU is past the wait queued on it
+  // when it was last used. The GPU is rarely that many rebinds behind
+  if (ptex->fences_done[i]) {
+    psglx->glClientWaitSyncProc(ptex->fences_done[i],
+        GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    psglx->glDeleteSyncProc(ptex->fences_done[i]);
+    ptex->fences_done[i] = NULL;
+  }
+
+  // Fences are created triggered, and reset before every use
+  if (!ptex->fences[i])
+    ptex->fences[i] = XSyncCreateFence(ps->dpy, ptex->pixmap, True);
+  if (!ptex->fences[i]) {
+    printf_errf("(%#010x): Failed to create X Sync fence.", ptex->pixmap);
+    return;
+  }
+  XSyncResetFence(ps->dpy, ptex->fences[i]);
+  XSyncTriggerFence(ps->dpy, ptex->fences[i]);
+  // The GPU would stall until the trigger reaches the X server
+  XFlush(ps->dpy);
+
+  GLsync sync = psglx->glImportSyncEXT(GL_SYNC_X11_FENCE_EXT,
+      ptex->fences[i], 0);
+  if (!sync) {
+    printf_errf("(%#010x): Failed to import X Sync fence.", ptex->pixmap);
+    return;
+  }
+  psglx->glWaitSyncProc(sync, 0, GL_TIMEOUT_IGNORED);
+  // Deletion is deferred until the wait is done
+  psglx->glDeleteSyncProc(sync);
+  ptex->fences_done[i] =
+    psglx->glFenceSyncProc(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/**
+ * Free the fences of a texture, once the GPU is past the waits on them.
+ */
+static void
+glx_free_pixmap_fences(session_t *ps, glx_texture_t *ptex) {
+  for (int i = 0; i < GLX_PIXMAP_FENCES; ++i) {
+    if (ptex->fences_done[i]) {
+      ps->psglx->glClientWaitSyncProc(ptex->fences_done[i],
+          GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+      ps->psglx->glDeleteSyncProc(ptex->fences_done[i]);
+      ptex->fences_done[i] = NULL;
+    }
+    free_fence(ps, &ptex->fences[i]);
+  }
+  ptex->fence_next = 0;
+}
+
 /**
  * Bind a X pixmap to an OpenGL texture.
  */
@@ -706,6 +1150,7 @@ glx_bind_pixmap(session_t *ps, glx_texture_t **pptex, xcb_pixmap_t pixmap,
       .height = 0,
       .depth = 0,
       .y_inverted = false,
+      .fence_next = 0,
     };
 
     ptex = cmalloc(glx_texture_t);
@@ -818,6 +1263,8 @@ glx_bind_pixmap(session_t *ps, glx_texture_t **pptex, xcb_pixmap_t pixmap,
   if (need_release)
     ps->psglx->glXReleaseTexImageProc(ps->dpy, ptex->glpixmap, GLX_FRONT_LEFT_EXT);
 
+  glx_sync_pixmap(ps, ptex);
+
   ps->psglx->glXBindTexImageProc(ps->dpy, ptex->glpixmap, GLX_FRONT_LEFT_EXT, NULL);
 
   // Cleanup
@@ -841,6 +1288,8 @@ glx_release_pixmap(session_t *ps, glx_texture_t *ptex) {
     glBindTexture(ptex->target, 0);
   }
 
+  glx_free_pixmap_fences(ps, ptex);
+
   // Free GLX Pixmap
   if (ptex->glpixmap) {
     glXDestroyPixmap(ps->dpy, ptex->glpixmap);
@@ -856,6 +1305,8 @@ glx_release_pixmap(session_t *ps, glx_texture_t *ptex) {
 void
 glx_paint_pre(session_t *ps, region_t *preg) {
   ps->psglx->z = 0.0;
+  // Start the frame with a fresh vertex buffer
+  ps->psglx->vbo_used = ps->psglx->vbo_size;
   // glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // Get buffer age
@@ -937,6 +1388,79 @@ glx_set_clip(session_t *ps, const region_t *reg) {
   glx_check_err(ps);
 }
 
+/**
+ * Add a quad from (x1, y1) to (x2, y2), with texture coordinates from (tx1,
+ * ty1) to (tx2, ty2), to the quads painted by the next glx_quads_draw().
+ */
+static inline void
+glx_quad_add(session_t *ps, GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2,
+    GLfloat tx1, GLfloat ty1, GLfloat tx2, GLfloat ty2, GLfloat z) {
+  glx_session_t *psglx = ps->psglx;
+  if (psglx->nquad_verts + 4 > psglx->quads_cap) {
+    psglx->quads_cap = max_i(psglx->quads_cap * 2, 64);
+    psglx->quads = crealloc(psglx->quads,
+        psglx->quads_cap * GLX_VERTEX_FLOATS);
+  }
+
+  const GLfloat verts[4 * GLX_VERTEX_FLOATS] = {
+    x1, y1, z, tx1, ty1,
+    x2, y1, z, tx2, ty1,
+    x2, y2, z, tx2, ty2,
+    x1, y2, z, tx1, ty2,
+  };
+  memcpy(psglx->quads + psglx->nquad_verts * GLX_VERTEX_FLOATS, verts,
+      sizeof(verts));
+  psglx->nquad_verts += 4;
+}
+
+/**
+ * Append size bytes of vertices to the vertex buffer of the frame.
+ *
+ * The buffer is only orphaned once it's full, so the driver never waits for
+ * earlier draw calls reading it.
+ *
+ * @return the offset of the vertices in the buffer, in bytes
+ */
+static GLintptr
+glx_vbo_upload(session_t *ps, const GLfloat *data, int size) {
+  glx_session_t *psglx = ps->psglx;
+  const int n = (size + GLX_VERTEX_STRIDE - 1) / GLX_VERTEX_STRIDE;
+
+  if (psglx->vbo_used + n > psglx->vbo_size) {
+    while (n > psglx->vbo_size)
+      psglx->vbo_size *= 2;
+    glBufferData(GL_ARRAY_BUFFER, psglx->vbo_size * GLX_VERTEX_STRIDE, NULL,
+        GL_STREAM_DRAW);
+    psglx->vbo_used = 0;
+  }
+
+  const GLintptr offset = psglx->vbo_used * GLX_VERTEX_STRIDE;
+  glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+  psglx->vbo_used += n;
+
+  return offset;
+}
+
+/**
+ * Paint the quads added since the last call with one draw call.
+ *
+ * Every paint call draws its own quads, they aren't merged across calls,
+ * which change the texture, program uniforms or blend state in between.
+ * Analytic shadows are the exception, see glx_shadows_flush().
+ */
+static void
+glx_quads_draw(session_t *ps) {
+  glx_session_t *psglx = ps->psglx;
+  const int n = psglx->nquad_verts;
+  if (!n)
+    return;
+  psglx->nquad_verts = 0;
+
+  const GLintptr offset =
+    glx_vbo_upload(ps, psglx->quads, n * GLX_VERTEX_STRIDE);
+  glDrawArrays(GL_QUADS, offset / GLX_VERTEX_STRIDE, n);
+}
+
 #define P_PAINTREG_START(var) \
   region_t reg_new; \
   int nrects; \
@@ -944,14 +1468,13 @@ glx_set_clip(session_t *ps, const region_t *reg) {
   pixman_region32_init_rect(&reg_new, dx, dy, width, height); \
   pixman_region32_intersect(&reg_new, &reg_new, (region_t *)reg_tgt); \
   rects = pixman_region32_rectangles(&reg_new, &nrects); \
-  glBegin(GL_QUADS); \
  \
   for (int ri = 0; ri < nrects; ++ri) { \
     rect_t var = rects[ri];
 
 #define P_PAINTREG_END() \
   } \
-  glEnd(); \
+  glx_quads_draw(ps); \
  \
   pixman_region32_fini(&reg_new);
 
@@ -981,16 +1504,232 @@ glx_copy_region_to_tex(session_t *ps, GLenum tex_tgt, int basex, int basey,
         dx, ps->root_height - dy - height, width, height);
 }
 
+/// Size of a texture of the dual Kawase blur downsampled level times
+static inline int
+kawase_level_size(int size, int level) {
+  return max_i(size >> level, 1);
+}
+
+/**
+ * Set the uniforms of a dual Kawase pass reading a level of a blur cache.
+ *
+ * @param width width of the area blurred
+ * @param height height of the area blurred
+ * @param pscale_x returns the texture coordinate of a pixel of the area in x
+ * @param pscale_y returns the texture coordinate of a pixel of the area in y
+ */
+static inline void
+glx_kawase_use(session_t *ps, const glx_kawase_pass_t *ppass, GLenum tex_tgt,
+    const glx_blur_cache_t *pbc, int level, int width, int height,
+    GLfloat *pscale_x, GLfloat *pscale_y) {
+  const int lwidth = kawase_level_size(width, level),
+        lheight = kawase_level_size(height, level);
+  GLfloat texfac_x = 1.0f, texfac_y = 1.0f;
+  if (GL_TEXTURE_2D == tex_tgt) {
+    texfac_x /= kawase_level_size(pbc->width, level);
+    texfac_y /= kawase_level_size(pbc->height, level);
+  }
+
+  glUseProgram(ppass->prog);
+  if (ppass->unifm_pixel >= 0)
+    glUniform2f(ppass->unifm_pixel, texfac_x, texfac_y);
+  if (ppass->unifm_offset >= 0)
+    glUniform1f(ppass->unifm_offset,
+        KAWASE_STRENGTHS[ps->o.blur_strength - 1].offset);
+  if (ppass->unifm_tex_max >= 0)
+    glUniform2f(ppass->unifm_tex_max, lwidth * texfac_x, lheight * texfac_y);
+
+  *pscale_x = (GLfloat) lwidth / width * texfac_x;
+  *pscale_y = (GLfloat) lheight / height * texfac_y;
+}
+
+/**
+ * Run a dual Kawase pass from a level of a blur cache into another, through
+ * the framebuffer bound.
+ */
+static bool
+glx_kawase_pass(session_t *ps, const glx_kawase_pass_t *ppass, GLenum tex_tgt,
+    const glx_blur_cache_t *pbc, GLuint tex_src, int src_level,
+    GLuint tex_dst, int dst_level, int width, int height, float z) {
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_tgt,
+      tex_dst, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    printf_errf("(): Framebuffer attachment failed.");
+    return false;
+  }
+
+  glBindTexture(tex_tgt, tex_src);
+  GLfloat scale_x, scale_y;
+  glx_kawase_use(ps, ppass, tex_tgt, pbc, src_level, width, height,
+      &scale_x, &scale_y);
+
+  const GLfloat rxe = width * scale_x, rye = height * scale_y;
+  const GLfloat rdxe = kawase_level_size(width, dst_level),
+        rdye = kawase_level_size(height, dst_level);
+
+  glx_quad_add(ps, 0.0f, 0.0f, rdxe, rdye, 0.0f, 0.0f, rxe, rye, z);
+  glx_quads_draw(ps);
+
+  glUseProgram(0);
+
+  return true;
+}
+
+/**
+ * Blur contents in a particular region with the dual Kawase filter.
+ *
+ * The contents are downsampled into textures of halving sizes, then
+ * upsampled back, each pass taking a few bilinear samples, so the cost
+ * barely grows with the strength.
+ */
+static bool
+glx_kawase_blur_dst(session_t *ps, int dx, int dy, int width, int height,
+    float z, GLfloat blend, const region_t *reg_tgt,
+    glx_blur_cache_t *pbc) {
+  assert(ps->psglx->kawase_down.prog && ps->psglx->kawase_up.prog);
+  const int levels = KAWASE_STRENGTHS[ps->o.blur_strength - 1].levels;
+  assert(levels <= GLX_KAWASE_MAX_LEVELS);
+  const bool have_scissors = glIsEnabled(GL_SCISSOR_TEST);
+  const bool have_stencil = glIsEnabled(GL_STENCIL_TEST);
+  bool ret = false;
+
+  glx_blur_cache_t ibc = { .width = 0, .height = 0 };
+  if (!pbc)
+    pbc = &ibc;
+
+  GLenum tex_tgt = GL_TEXTURE_RECTANGLE;
+  if (ps->psglx->has_texture_non_power_of_two)
+    tex_tgt = GL_TEXTURE_2D;
+
+  // Textures are only reallocated if they are too small for the area
+  if (width > pbc->width || height > pbc->height)
+    free_glx_bc_resize(ps, pbc);
+  if (!pbc->textures[0]) {
+    pbc->width = width;
+    pbc->height = height;
+  }
+
+  // Level 0 holds the contents, each level after it is half the size
+  GLuint textures[GLX_KAWASE_MAX_LEVELS + 1];
+  for (int i = 0; i <= levels; ++i) {
+    GLuint *ptex = (i ? &pbc->kawase_textures[i - 1]: &pbc->textures[0]);
+    if (!*ptex)
+      *ptex = glx_gen_texture(ps, tex_tgt, kawase_level_size(pbc->width, i),
+          kawase_level_size(pbc->height, i));
+    if (!*ptex) {
+      printf_errf("(): Failed to allocate texture.");
+      goto glx_kawase_blur_dst_end;
+    }
+    textures[i] = *ptex;
+  }
+  if (!pbc->fbo)
+    glGenFramebuffers(1, &pbc->fbo);
+  if (!pbc->fbo) {
+    printf_errf("(): Failed to allocate framebuffer.");
+    goto glx_kawase_blur_dst_end;
+  }
+
+  // Read destination pixels into a texture
+  glEnable(tex_tgt);
+  glBindTexture(tex_tgt, textures[0]);
+  glx_copy_region_to_tex(ps, tex_tgt, dx, dy, dx, dy, width, height);
+
+  glDisable(GL_STENCIL_TEST);
+  glDisable(GL_SCISSOR_TEST);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+  {
+    static const GLenum DRAWBUFS[1] = { GL_COLOR_ATTACHMENT0 };
+    glBindFramebuffer(GL_FRAMEBUFFER, pbc->fbo);
+    glDrawBuffers(1, DRAWBUFS);
+  }
+
+  // Down to the smallest level, and back up to level 1
+  for (int i = 1; i <= levels; ++i)
+    if (!glx_kawase_pass(ps, &ps->psglx->kawase_down, tex_tgt, pbc,
+          textures[i - 1], i - 1, textures[i], i, width, height, z))
+      goto glx_kawase_blur_dst_end;
+  for (int i = levels - 1; i >= 1; --i)
+    if (!glx_kawase_pass(ps, &ps->psglx->kawase_up, tex_tgt, pbc,
+          textures[i + 1], i + 1, textures[i], i, width, height, z))
+      goto glx_kawase_blur_dst_end;
+
+  // The last pass paints level 1 back, upsampled
+  {
+    static const GLenum DRAWBUFS[1] = { GL_BACK };
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDrawBuffers(1, DRAWBUFS);
+  }
+  if (have_scissors)
+    glEnable(GL_SCISSOR_TEST);
+  if (have_stencil)
+    glEnable(GL_STENCIL_TEST);
+  if (blend < 1.0f) {
+    glEnable(GL_BLEND);
+    glBlendColor(0.0f, 0.0f, 0.0f, blend);
+    glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+  }
+
+  glBindTexture(tex_tgt, textures[1]);
+  GLfloat scale_x, scale_y;
+  glx_kawase_use(ps, &ps->psglx->kawase_up, tex_tgt, pbc, 1, width, height,
+      &scale_x, &scale_y);
+
+  {
+    P_PAINTREG_START(crect) {
+      const GLfloat rx = (crect.x1 - dx) * scale_x;
+      const GLfloat ry = (height - (crect.y1 - dy)) * scale_y;
+      const GLfloat rxe = rx + (crect.x2 - crect.x1) * scale_x;
+      const GLfloat rye = ry - (crect.y2 - crect.y1) * scale_y;
+      const GLfloat rdx = crect.x1;
+      const GLfloat rdy = ps->root_height - crect.y1;
+      const GLfloat rdxe = rdx + (crect.x2 - crect.x1);
+      const GLfloat rdye = rdy - (crect.y2 - crect.y1);
+
+      glx_quad_add(ps, rdx, rdy, rdxe, rdye, rx, ry, rxe, rye, z);
+    } P_PAINTREG_END();
+  }
+
+  glUseProgram(0);
+
+  ret = true;
+
+glx_kawase_blur_dst_end:
+  glDisable(GL_BLEND);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindTexture(tex_tgt, 0);
+  glDisable(tex_tgt);
+  if (have_scissors)
+    glEnable(GL_SCISSOR_TEST);
+  if (have_stencil)
+    glEnable(GL_STENCIL_TEST);
+
+  if (&ibc == pbc) {
+    free_glx_bc(ps, pbc);
+  }
+
+  glx_check_err(ps);
+
+  return ret;
+}
+
 /**
  * Blur contents in a particular region.
  *
+ * The last pass mixes the blurred contents with the unblurred ones if blend
+ * is less than 1.
+ *
  * XXX seems to be way to complex for what it does
  */
 bool
 glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
-    GLfloat factor_center,
+    GLfloat factor_center, GLfloat blend,
     const region_t *reg_tgt,
     glx_blur_cache_t *pbc) {
+  if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE)
+    return glx_kawase_blur_dst(ps, dx, dy, width, height, z, blend, reg_tgt,
+        pbc);
+
   assert(ps->psglx->blur_passes[0].prog);
   const bool more_passes = ps->psglx->blur_passes[1].prog;
   const bool have_scissors = glIsEnabled(GL_SCISSOR_TEST);
@@ -1032,18 +1771,23 @@ glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
   if (ps->psglx->has_texture_non_power_of_two)
     tex_tgt = GL_TEXTURE_2D;
 
-  // Free textures if size inconsistency discovered
-  if (mwidth != pbc->width || mheight != pbc->height)
+  // The area blurred changes with the damage, textures are only
+  // reallocated if they are too small for it. Taps with texture offsets
+  // can't be clamped to the area, so they need textures of its exact size
+  if (mwidth > pbc->width || mheight > pbc->height
+      || (ps->o.glx_use_gpushader4
+        && (mwidth != pbc->width || mheight != pbc->height)))
     free_glx_bc_resize(ps, pbc);
 
   // Generate FBO and textures if needed
-  if (!pbc->textures[0])
+  if (!pbc->textures[0]) {
     pbc->textures[0] = glx_gen_texture(ps, tex_tgt, mwidth, mheight);
+    pbc->width = mwidth;
+    pbc->height = mheight;
+  }
   GLuint tex_scr = pbc->textures[0];
   if (more_passes && !pbc->textures[1])
-    pbc->textures[1] = glx_gen_texture(ps, tex_tgt, mwidth, mheight);
-  pbc->width = mwidth;
-  pbc->height = mheight;
+    pbc->textures[1] = glx_gen_texture(ps, tex_tgt, pbc->width, pbc->height);
   GLuint tex_scr2 = pbc->textures[1];
   if (more_passes && !pbc->fbo)
     glGenFramebuffers(1, &pbc->fbo);
@@ -1076,8 +1820,8 @@ glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
   // Texture scaling factor
   GLfloat texfac_x = 1.0f, texfac_y = 1.0f;
   if (GL_TEXTURE_2D == tex_tgt) {
-    texfac_x /= mwidth;
-    texfac_y /= mheight;
+    texfac_x /= pbc->width;
+    texfac_y /= pbc->height;
   }
 
   // Paint it back
@@ -1116,6 +1860,11 @@ glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
         glEnable(GL_SCISSOR_TEST);
       if (have_stencil)
         glEnable(GL_STENCIL_TEST);
+      if (blend < 1.0f) {
+        glEnable(GL_BLEND);
+        glBlendColor(0.0f, 0.0f, 0.0f, blend);
+        glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+      }
     }
 
     // Color negation for testing...
@@ -1131,6 +1880,9 @@ glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
       glUniform1f(ppass->unifm_offset_y, texfac_y);
     if (ppass->unifm_factor_center >= 0)
       glUniform1f(ppass->unifm_factor_center, factor_center);
+    if (ppass->unifm_tex_max >= 0)
+      glUniform2f(ppass->unifm_tex_max, mwidth * texfac_x,
+          mheight * texfac_y);
 
     {
       P_PAINTREG_START(crect) {
@@ -1151,17 +1903,7 @@ glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
         printf_dbgf("(): %f, %f, %f, %f -> %f, %f, %f, %f\n", rx, ry, rxe, rye, rdx, rdy, rdxe, rdye);
 #endif
 
-        glTexCoord2f(rx, ry);
-        glVertex3f(rdx, rdy, z);
-
-        glTexCoord2f(rxe, ry);
-        glVertex3f(rdxe, rdy, z);
-
-        glTexCoord2f(rxe, rye);
-        glVertex3f(rdxe, rdye, z);
-
-        glTexCoord2f(rx, rye);
-        glVertex3f(rdx, rdye, z);
+        glx_quad_add(ps, rdx, rdy, rdxe, rdye, rx, ry, rxe, rye, z);
       } P_PAINTREG_END();
     }
 
@@ -1178,6 +1920,7 @@ glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
   ret = true;
 
 glx_blur_dst_end:
+  glDisable(GL_BLEND);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   glBindTexture(tex_tgt, 0);
   glDisable(tex_tgt);
@@ -1195,6 +1938,105 @@ glx_blur_dst_end:
   return ret;
 }
 
+/**
+ * Keep a blurred region of the back buffer in the result texture of a blur
+ * cache, to be painted again with glx_blur_cache_paint().
+ *
+ * Rows of the texture are bottom up, like in glx_blur_dst().
+ *
+ * @param x,y,width,height the area the texture covers
+ */
+bool
+glx_blur_cache_store(session_t *ps, glx_blur_cache_t *pbc,
+    int x, int y, int width, int height, const region_t *reg) {
+  GLenum tex_tgt = GL_TEXTURE_RECTANGLE;
+  if (ps->psglx->has_texture_non_power_of_two)
+    tex_tgt = GL_TEXTURE_2D;
+
+  if (width != pbc->result_width || height != pbc->result_height) {
+    free_texture_r(ps, &pbc->result);
+    pbc->result_width = 0;
+    pbc->result_height = 0;
+  }
+  if (!pbc->result) {
+    pbc->result = glx_gen_texture(ps, tex_tgt, width, height);
+    if (!pbc->result) {
+      printf_errf("(): Failed to allocate texture.");
+      return false;
+    }
+    pbc->result_width = width;
+    pbc->result_height = height;
+  }
+
+  int nrects;
+  const rect_t *rects = pixman_region32_rectangles((region_t *)reg, &nrects);
+  glBindTexture(tex_tgt, pbc->result);
+  for (int i = 0; i < nrects; ++i) {
+    const int rwid = rects[i].x2 - rects[i].x1;
+    const int rhei = rects[i].y2 - rects[i].y1;
+    glCopyTexSubImage2D(tex_tgt, 0, rects[i].x1 - x,
+        height - (rects[i].y2 - y), rects[i].x1,
+        ps->root_height - rects[i].y2, rwid, rhei);
+  }
+  glBindTexture(tex_tgt, 0);
+
+  glx_check_err(ps);
+
+  return true;
+}
+
+/**
+ * Paint a region from the result texture of a blur cache.
+ *
+ * @param x,y where the area covered by the texture is
+ */
+bool
+glx_blur_cache_paint(session_t *ps, const glx_blur_cache_t *pbc,
+    int x, int y, float z, const region_t *reg_tgt) {
+  if (!pbc->result) {
+    printf_errf("(): Missing texture.");
+    return false;
+  }
+
+  GLenum tex_tgt = GL_TEXTURE_RECTANGLE;
+  if (ps->psglx->has_texture_non_power_of_two)
+    tex_tgt = GL_TEXTURE_2D;
+
+  GLfloat texfac_x = 1.0f, texfac_y = 1.0f;
+  if (GL_TEXTURE_2D == tex_tgt) {
+    texfac_x /= pbc->result_width;
+    texfac_y /= pbc->result_height;
+  }
+
+  glEnable(tex_tgt);
+  glBindTexture(tex_tgt, pbc->result);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+  {
+    const int dx = x, dy = y;
+    const int width = pbc->result_width, height = pbc->result_height;
+    P_PAINTREG_START(crect) {
+      const GLfloat rx = (crect.x1 - x) * texfac_x;
+      const GLfloat ry = (height - (crect.y1 - y)) * texfac_y;
+      const GLfloat rxe = rx + (crect.x2 - crect.x1) * texfac_x;
+      const GLfloat rye = ry - (crect.y2 - crect.y1) * texfac_y;
+      const GLfloat rdx = crect.x1;
+      const GLfloat rdy = ps->root_height - crect.y1;
+      const GLfloat rdxe = rdx + (crect.x2 - crect.x1);
+      const GLfloat rdye = rdy - (crect.y2 - crect.y1);
+
+      glx_quad_add(ps, rdx, rdy, rdxe, rdye, rx, ry, rxe, rye, z);
+    } P_PAINTREG_END();
+  }
+
+  glBindTexture(tex_tgt, 0);
+  glDisable(tex_tgt);
+
+  glx_check_err(ps);
+
+  return true;
+}
+
 bool
 glx_dim_dst(session_t *ps, int dx, int dy, int width, int height, float z,
     GLfloat factor, const region_t *reg_tgt) {
@@ -1212,16 +2054,11 @@ glx_dim_dst(session_t *ps, int dx, int dy, int width, int height, float z,
       GLint rdxe = rdx + (crect.x2 - crect.x1);
       GLint rdye = rdy - (crect.y2 - crect.y1);
 
-      glVertex3i(rdx, rdy, z);
-      glVertex3i(rdxe, rdy, z);
-      glVertex3i(rdxe, rdye, z);
-      glVertex3i(rdx, rdye, z);
+      glx_quad_add(ps, rdx, rdy, rdxe, rdye, 0.0f, 0.0f, 0.0f, 0.0f, z);
     }
     P_PAINTREG_END();
   }
 
-  glEnd();
-
   glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
   glDisable(GL_BLEND);
 
@@ -1364,6 +2201,10 @@ glx_render(session_t *ps, const glx_texture_t *ptex,
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(ptex->target, ptex->texture);
     glActiveTexture(GL_TEXTURE0);
+    // Both stages read the same coordinates
+    glClientActiveTexture(GL_TEXTURE1);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glClientActiveTexture(GL_TEXTURE0);
   }
 
   // Painting
@@ -1398,24 +2239,7 @@ glx_render(session_t *ps, const glx_texture_t *ptex,
       printf_dbgf("(): Rect %d: %f, %f, %f, %f -> %d, %d, %d, %d\n", ri, rx, ry, rxe, rye, rdx, rdy, rdxe, rdye);
 #endif
 
-#define P_TEXCOORD(cx, cy) { \
-  if (dual_texture) { \
-    glMultiTexCoord2f(GL_TEXTURE0, cx, cy); \
-    glMultiTexCoord2f(GL_TEXTURE1, cx, cy); \
-  } \
-  else glTexCoord2f(cx, cy); \
-}
-      P_TEXCOORD(rx, ry);
-      glVertex3i(rdx, rdy, z);
-
-      P_TEXCOORD(rxe, ry);
-      glVertex3i(rdxe, rdy, z);
-
-      P_TEXCOORD(rxe, rye);
-      glVertex3i(rdxe, rdye, z);
-
-      P_TEXCOORD(rx, rye);
-      glVertex3i(rdx, rdye, z);
+      glx_quad_add(ps, rdx, rdy, rdxe, rdye, rx, ry, rxe, rye, z);
     } P_PAINTREG_END();
   }
 
@@ -1432,6 +2256,9 @@ glx_render(session_t *ps, const glx_texture_t *ptex,
     glBindTexture(ptex->target, 0);
     glDisable(ptex->target);
     glActiveTexture(GL_TEXTURE0);
+    glClientActiveTexture(GL_TEXTURE1);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glClientActiveTexture(GL_TEXTURE0);
   }
 
   if (has_prog)
@@ -1442,6 +2269,295 @@ glx_render(session_t *ps, const glx_texture_t *ptex,
   return true;
 }
 
+/**
+ * @brief Upload 8-bit alpha data into a texture, not backed by any pixmap.
+ *
+ * The alpha is stored as intensity, so modulating the texture with a
+ * premultiplied color gives a premultiplied result.
+ */
+bool
+glx_load_alpha_texture(session_t *ps, glx_texture_t **pptex,
+    const uint8_t *data, int stride, int width, int height) {
+  glx_texture_t *ptex = *pptex;
+  if (!ptex) {
+    ptex = *pptex = ccalloc(1, glx_texture_t);
+    ptex->target = ps->psglx->has_texture_non_power_of_two ?
+      GL_TEXTURE_2D : GL_TEXTURE_RECTANGLE;
+    glGenTextures(1, &ptex->texture);
+    if (!ptex->texture) {
+      printf_errf("(): Failed to allocate texture.");
+      return false;
+    }
+    glBindTexture(ptex->target, ptex->texture);
+    glTexParameteri(ptex->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(ptex->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(ptex->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(ptex->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  else
+    glBindTexture(ptex->target, ptex->texture);
+
+  ptex->width = width;
+  ptex->height = height;
+  ptex->depth = 8;
+  // Rows are uploaded top to bottom
+  ptex->y_inverted = true;
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+  glTexImage2D(ptex->target, 0, GL_INTENSITY8, width, height, 0,
+      GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(ptex->target, 0);
+
+  glx_check_err(ps);
+
+  return true;
+}
+
+/**
+ * @brief Render a window with a built-in window program, in one pass.
+ *
+ * @param body the part of the window inside its frame, in root coordinates
+ * @param dim opacity of the black painted over the window to dim it
+ *
+ * @return false if there's no program for the texture, in which case
+ *         nothing is painted
+ */
+bool
+glx_render_win(session_t *ps, const glx_texture_t *ptex,
+    int dx, int dy, int width, int height, int z,
+    double opacity, double frame_opacity, const pixman_box32_t *body,
+    double dim, bool argb, bool neg, const region_t *reg_tgt) {
+  if (!ptex || !ptex->texture) {
+    printf_errf("(): Missing texture.");
+    return false;
+  }
+
+  const glx_win_prog_t *pprogram =
+    &ps->psglx->win_progs[GL_TEXTURE_RECTANGLE == ptex->target];
+  if (!pprogram->prog)
+    return false;
+
+  argb = argb || (GLX_TEXTURE_FORMAT_RGBA_EXT ==
+      ps->psglx->fbconfigs[ptex->depth]->texture_fmt);
+  if (opacity < 1.0 || frame_opacity < 1.0 || dim > 0.0 || argb) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  }
+
+  glUseProgram(pprogram->prog);
+  glUniform1f(pprogram->unifm_opacity, opacity);
+  glUniform1f(pprogram->unifm_frame_opacity, frame_opacity);
+  glUniform4f(pprogram->unifm_body, body->x1, body->y1, body->x2, body->y2);
+  glUniform1f(pprogram->unifm_root_height, ps->root_height);
+  glUniform1f(pprogram->unifm_dim, dim);
+  glUniform1i(pprogram->unifm_invert_color, neg);
+  glUniform1i(pprogram->unifm_tex, 0);
+
+  glBindTexture(ptex->target, ptex->texture);
+
+  {
+    P_PAINTREG_START(crect) {
+      GLfloat rx = crect.x1 - dx;
+      GLfloat ry = crect.y1 - dy;
+      GLfloat rxe = rx + (crect.x2 - crect.x1);
+      GLfloat rye = ry + (crect.y2 - crect.y1);
+      if (GL_TEXTURE_2D == ptex->target) {
+        rx = rx / ptex->width;
+        ry = ry / ptex->height;
+        rxe = rxe / ptex->width;
+        rye = rye / ptex->height;
+      }
+      GLint rdx = crect.x1;
+      GLint rdy = ps->root_height - crect.y1;
+      GLint rdxe = rdx + (crect.x2 - crect.x1);
+      GLint rdye = rdy - (crect.y2 - crect.y1);
+
+      if (!ptex->y_inverted) {
+        ry = 1.0 - ry;
+        rye = 1.0 - rye;
+      }
+
+      glx_quad_add(ps, rdx, rdy, rdxe, rdye, rx, ry, rxe, rye, z);
+    } P_PAINTREG_END();
+  }
+
+  // Cleanup
+  glBindTexture(ptex->target, 0);
+  glUseProgram(0);
+  glDisable(GL_BLEND);
+
+  glx_check_err(ps);
+
+  return true;
+}
+
+/**
+ * @brief Render a region of shadow, using an alpha texture from
+ *        glx_load_alpha_texture() as the mask of the shadow color.
+ */
+bool
+glx_render_shadow(session_t *ps, const glx_texture_t *ptex,
+    int x, int y, int dx, int dy, int width, int height, int z,
+    double opacity, const region_t *reg_tgt) {
+  if (!ptex || !ptex->texture) {
+    printf_errf("(): Missing texture.");
+    return false;
+  }
+
+  glEnable(ptex->target);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glColor4f(ps->o.shadow_red * opacity, ps->o.shadow_green * opacity,
+      ps->o.shadow_blue * opacity, opacity);
+  glBindTexture(ptex->target, ptex->texture);
+
+  {
+    P_PAINTREG_START(crect) {
+      GLfloat rx = (double) (crect.x1 - dx + x);
+      GLfloat ry = (double) (crect.y1 - dy + y);
+      GLfloat rxe = rx + (double) (crect.x2 - crect.x1);
+      GLfloat rye = ry + (double) (crect.y2 - crect.y1);
+      if (GL_TEXTURE_2D == ptex->target) {
+        rx = rx / ptex->width;
+        ry = ry / ptex->height;
+        rxe = rxe / ptex->width;
+        rye = rye / ptex->height;
+      }
+      GLint rdx = crect.x1;
+      GLint rdy = ps->root_height - crect.y1;
+      GLint rdxe = rdx + (crect.x2 - crect.x1);
+      GLint rdye = rdy - (crect.y2 - crect.y1);
+
+      glx_quad_add(ps, rdx, rdy, rdxe, rdye, rx, ry, rxe, rye, z);
+    } P_PAINTREG_END();
+  }
+
+  // Cleanup
+  glBindTexture(ptex->target, 0);
+  glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  glDisable(GL_BLEND);
+  glDisable(ptex->target);
+
+  glx_check_err(ps);
+
+  return true;
+}
+
+/**
+ * @brief Add a region of shadow painted by the program from
+ *        glx_init_shadow() to the shadows painted by the next
+ *        glx_shadows_flush().
+ *
+ * @param x,y,wid,hei the rectangle casting the shadow
+ * @param dx,dy,width,height the area covered by the shadow
+ */
+bool
+glx_render_shadow_analytic(session_t *ps, int x, int y, int wid, int hei,
+    int dx, int dy, int width, int height, int z,
+    double opacity, const region_t *reg_tgt) {
+  glx_session_t *psglx = ps->psglx;
+  if (!psglx->shadow_prog.prog) {
+    printf_errf("(): Missing shadow program.");
+    return false;
+  }
+
+  const GLfloat r = ps->o.shadow_red * opacity;
+  const GLfloat g = ps->o.shadow_green * opacity;
+  const GLfloat b = ps->o.shadow_blue * opacity;
+  const GLfloat a = opacity;
+
+  region_t reg_new;
+  int nrects;
+  const rect_t *rects;
+  pixman_region32_init_rect(&reg_new, dx, dy, width, height);
+  pixman_region32_intersect(&reg_new, &reg_new, (region_t *)reg_tgt);
+  rects = pixman_region32_rectangles(&reg_new, &nrects);
+
+  if (psglx->nshadow_verts + 4 * nrects > psglx->shadow_verts_cap) {
+    psglx->shadow_verts_cap = max_i(psglx->shadow_verts_cap * 2,
+        max_i(psglx->nshadow_verts + 4 * nrects, 64));
+    psglx->shadow_verts = crealloc(psglx->shadow_verts,
+        psglx->shadow_verts_cap * GLX_SHADOW_VERTEX_FLOATS);
+  }
+
+  for (int ri = 0; ri < nrects; ++ri) {
+    const rect_t crect = rects[ri];
+    const GLfloat rdx = crect.x1;
+    const GLfloat rdy = ps->root_height - crect.y1;
+    const GLfloat rdxe = rdx + (crect.x2 - crect.x1);
+    const GLfloat rdye = rdy - (crect.y2 - crect.y1);
+
+    const GLfloat verts[4 * GLX_SHADOW_VERTEX_FLOATS] = {
+      rdx,  rdy,  z, x, y, x + wid, y + hei, r, g, b, a,
+      rdxe, rdy,  z, x, y, x + wid, y + hei, r, g, b, a,
+      rdxe, rdye, z, x, y, x + wid, y + hei, r, g, b, a,
+      rdx,  rdye, z, x, y, x + wid, y + hei, r, g, b, a,
+    };
+    memcpy(psglx->shadow_verts +
+        psglx->nshadow_verts * GLX_SHADOW_VERTEX_FLOATS, verts,
+        sizeof(verts));
+    psglx->nshadow_verts += 4;
+  }
+
+  pixman_region32_fini(&reg_new);
+
+  return true;
+}
+
+/**
+ * Paint the shadows added by glx_render_shadow_analytic() since the last
+ * call, with one draw call.
+ *
+ * Every shadow was cut to its own paint region when it was added, so the
+ * clip set for the last one is turned off while painting.
+ */
+void
+glx_shadows_flush(session_t *ps) {
+  glx_session_t *psglx = ps->psglx;
+  const int n = psglx->nshadow_verts;
+  if (!n)
+    return;
+  psglx->nshadow_verts = 0;
+
+  const GLintptr offset = glx_vbo_upload(ps, psglx->shadow_verts,
+      n * GLX_SHADOW_VERTEX_STRIDE);
+
+  const bool scissor = glIsEnabled(GL_SCISSOR_TEST);
+  if (scissor)
+    glDisable(GL_SCISSOR_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glUseProgram(psglx->shadow_prog.prog);
+  glUniform1f(psglx->shadow_prog.unifm_root_height, ps->root_height);
+
+  glVertexPointer(3, GL_FLOAT, GLX_SHADOW_VERTEX_STRIDE, (void *) offset);
+  glTexCoordPointer(4, GL_FLOAT, GLX_SHADOW_VERTEX_STRIDE,
+      (void *) (offset + 3 * sizeof(GLfloat)));
+  glColorPointer(4, GL_FLOAT, GLX_SHADOW_VERTEX_STRIDE,
+      (void *) (offset + 7 * sizeof(GLfloat)));
+  glEnableClientState(GL_COLOR_ARRAY);
+
+  glDrawArrays(GL_QUADS, 0, n);
+
+  // Cleanup
+  glDisableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_FLOAT, GLX_VERTEX_STRIDE, (void *) 0);
+  glTexCoordPointer(2, GL_FLOAT, GLX_VERTEX_STRIDE,
+      (void *) (3 * sizeof(GLfloat)));
+  glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
+  glUseProgram(0);
+  glDisable(GL_BLEND);
+  if (scissor)
+    glEnable(GL_SCISSOR_TEST);
+
+  glx_check_err(ps);
+}
+
 /**
  * @brief Get tightly packed RGB888 data from GL front buffer.
  *
@@ -125,6 +125,14 @@ glx_hasglext(session_t *ps, const char *ext) {
   return found;
 }
 
+bool
+glx_blur_cache_store(session_t *ps, glx_blur_cache_t *pbc,
+    int x, int y, int width, int height, const region_t *reg);
+
+bool
+glx_blur_cache_paint(session_t *ps, const glx_blur_cache_t *pbc,
+    int x, int y, float z, const region_t *reg_tgt);
+
 bool
 glx_dim_dst(session_t *ps, int dx, int dy, int width, int height, float z,
     GLfloat factor, const region_t *reg_tgt);
@@ -136,6 +144,32 @@ glx_render(session_t *ps, const glx_texture_t *ptex,
     const region_t *reg_tgt,
     const glx_prog_main_t *pprogram);
 
+bool
+glx_render_win(session_t *ps, const glx_texture_t *ptex,
+    int dx, int dy, int width, int height, int z,
+    double opacity, double frame_opacity, const pixman_box32_t *body,
+    double dim, bool argb, bool neg, const region_t *reg_tgt);
+
+bool
+glx_load_alpha_texture(session_t *ps, glx_texture_t **pptex,
+    const uint8_t *data, int stride, int width, int height);
+
+bool
+glx_render_shadow(session_t *ps, const glx_texture_t *ptex,
+    int x, int y, int dx, int dy, int width, int height, int z,
+    double opacity, const region_t *reg_tgt);
+
+bool
+glx_init_shadow(session_t *ps);
+
+bool
+glx_render_shadow_analytic(session_t *ps, int x, int y, int wid, int hei,
+    int dx, int dy, int width, int height, int z,
+    double opacity, const region_t *reg_tgt);
+
+void
+glx_shadows_flush(session_t *ps);
+
 bool
 glx_init(session_t *ps, bool need_render);
 
@@ -151,6 +185,9 @@ glx_on_root_change(session_t *ps);
 bool
 glx_init_blur(session_t *ps);
 
+int
+glx_kawase_radius(session_t *ps);
+
 #ifdef CONFIG_OPENGL
 bool
 glx_load_prog_main(session_t *ps,
@@ -182,7 +219,7 @@ glx_set_clip(session_t *ps, const region_t *reg);
 
 bool
 glx_blur_dst(session_t *ps, int dx, int dy, int width, int height, float z,
-    GLfloat factor_center,
+    GLfloat factor_center, GLfloat blend,
     const region_t *reg_tgt,
     glx_blur_cache_t *pbc);
 
@@ -207,6 +244,15 @@ glx_has_context(session_t *ps) {
   return ps->psglx && ps->psglx->context;
 }
 
+/**
+ * Check if binding a pixmap waits for X rendering to it with a fence
+ * imported into GL, making xr_sync() unnecessary.
+ */
+static inline bool
+glx_has_pixmap_fence(session_t *ps) {
+  return glx_has_context(ps) && ps->psglx->glImportSyncEXT;
+}
+
 /**
  * Ensure we have a GLX context.
  */
@@ -250,6 +296,8 @@ static inline void
 free_glx_bc_resize(session_t *ps, glx_blur_cache_t *pbc) {
   free_texture_r(ps, &pbc->textures[0]);
   free_texture_r(ps, &pbc->textures[1]);
+  for (int i = 0; i < GLX_KAWASE_MAX_LEVELS; ++i)
+    free_texture_r(ps, &pbc->kawase_textures[i]);
   pbc->width = 0;
   pbc->height = 0;
 }
@@ -261,6 +309,9 @@ static inline void
 free_glx_bc(session_t *ps, glx_blur_cache_t *pbc) {
   free_glx_fbo(ps, &pbc->fbo);
   free_glx_bc_resize(ps, pbc);
+  free_texture_r(ps, &pbc->result);
+  pbc->result_width = 0;
+  pbc->result_height = 0;
 }
 
 /**
@@ -298,7 +349,6 @@ free_paint_glx(session_t *ps, paint_t *ppaint) {
 static inline void
 free_win_res_glx(session_t *ps, win *w) {
   free_paint_glx(ps, &w->paint);
-  free_paint_glx(ps, &w->shadow_paint);
 #ifdef CONFIG_OPENGL
   free_glx_bc(ps, &w->glx_blur_cache);
 #endif
@@ -13,6 +13,7 @@
 #include "win.h"
 
 #include "render.h"
+#include "compton.h"
 
 #ifdef CONFIG_OPENGL
 /**
@@ -28,11 +29,32 @@ static inline bool paint_bind_tex(session_t *ps, paint_t *ppaint, unsigned wid,
 
 	return true;
 }
+
+/**
+ * Check if binding window pixmaps synchronizes with the X server by itself.
+ */
+static inline bool paint_bind_syncs(session_t *ps) {
+	return BKEND_GLX == ps->o.backend && !ps->o.glx_no_rebind_pixmap
+	       && glx_has_pixmap_fence(ps);
+}
+
+/**
+ * Move on to the z value of the next piece painted. With the depth test,
+ * paint_all() gives every window a fixed z, which all its pieces share.
+ */
+static inline void glx_z_next(session_t *ps) {
+	if (!ps->psglx->z_fixed)
+		ps->psglx->z += 1;
+}
 #else
 static inline bool paint_bind_tex(session_t *ps, paint_t *ppaint, unsigned wid,
                                   unsigned hei, unsigned depth, bool force) {
 	return true;
 }
+
+static inline bool paint_bind_syncs(session_t *ps) {
+	return false;
+}
 #endif
 
 /**
@@ -109,7 +131,7 @@ void render(session_t *ps, int x, int y, int dx, int dy, int wid, int hei, doubl
 	case BKEND_GLX:
 		glx_render(ps, ptex, x, y, dx, dy, wid, hei, ps->psglx->z, opacity, argb,
 		           neg, reg_paint, pprogram);
-		ps->psglx->z += 1;
+		glx_z_next(ps);
 		break;
 #endif
 	default: assert(0);
@@ -149,6 +171,41 @@ static inline bool paint_isvalid(session_t *ps, const paint_t *ppaint) {
 	return true;
 }
 
+#ifdef CONFIG_OPENGL
+/**
+ * Paint a window with a built-in GLX window program, the frame, the body and
+ * the dimming in one draw.
+ *
+ * @return false if the program can't paint the window
+ */
+static bool win_paint_glx(session_t *ps, win *w, double opacity, double dim,
+                          const region_t *reg_paint) {
+	const int x = w->g.x, y = w->g.y;
+	const int wid = w->widthb, hei = w->heightb;
+
+	// The part inside the frame, with the margins sanitized like when the
+	// frame is painted piece by piece
+	pixman_box32_t body = {x, y, x + wid, y + hei};
+	if (w->frame_opacity != 1) {
+		const margin_t extents = win_calc_frame_extents(w);
+		const int ctop = min_i(hei, extents.top);
+		const int cbot = min_i(hei - ctop, extents.bottom);
+		const int cleft = min_i(wid, extents.left);
+		const int cright = min_i(wid - cleft, extents.right);
+		body = (pixman_box32_t){x + cleft, y + ctop, x + wid - cright,
+		                        y + hei - cbot};
+	}
+
+	const bool argb = win_has_alpha(w) || ps->o.force_win_blend;
+	if (!glx_render_win(ps, w->paint.ptex, x, y, wid, hei, ps->psglx->z,
+	                    opacity, w->frame_opacity, &body, dim, argb,
+	                    w->invert_color, reg_paint))
+		return false;
+	glx_z_next(ps);
+	return true;
+}
+#endif
+
 /**
  * Paint a window itself and dim it if asked.
  */
@@ -178,7 +235,9 @@ void paint_one(session_t *ps, win *w, const region_t *reg_paint) {
 		    ps, w->pictfmt, draw, XCB_RENDER_CP_SUBWINDOW_MODE, &pa);
 	}
 
-	if (IsViewable == w->a.map_state)
+	// Only new content needs to be waited for
+	if (IsViewable == w->a.map_state && w->pixmap_damaged
+	    && !paint_bind_syncs(ps))
 		xr_sync(ps, draw, &w->fence);
 
 	// GLX: Build texture
@@ -235,6 +294,21 @@ void paint_one(session_t *ps, win *w, const region_t *reg_paint) {
 
 	const double dopacity = get_opacity_percent(w);
 
+	double dim_opacity = 0.0;
+	if (w->dim) {
+		dim_opacity = ps->o.inactive_dim;
+		if (!ps->o.inactive_dim_fixed)
+			dim_opacity *= get_opacity_percent(w);
+	}
+
+#ifdef CONFIG_OPENGL
+	if (BKEND_GLX == ps->o.backend && !ps->o.glx_prog_win.prog &&
+	    win_paint_glx(ps, w, dopacity, dim_opacity, reg_paint)) {
+		glx_mark(ps, w->id, false);
+		return;
+	}
+#endif
+
 	if (w->frame_opacity == 1) {
 		paint_region(ps, w, 0, 0, wid, hei, dopacity, reg_paint, pict);
 	} else {
@@ -310,10 +384,6 @@ void paint_one(session_t *ps, win *w, const region_t *reg_paint) {
 
 	// Dimming the window if needed
 	if (w->dim) {
-		double dim_opacity = ps->o.inactive_dim;
-		if (!ps->o.inactive_dim_fixed)
-			dim_opacity *= get_opacity_percent(w);
-
 		switch (ps->o.backend) {
 		case BKEND_XRENDER:
 		case BKEND_XR_GLX_HYBRID: {
@@ -436,8 +506,15 @@ static void paint_root(session_t *ps, const region_t *reg_paint) {
 	             ps->root_tile_paint.pict);
 }
 
-static xcb_image_t *make_shadow(session_t *ps, double opacity, int width, int height) {
-	xcb_image_t *ximage;
+/**
+ * Draw the shadow of a window of the given size into an 8-bit image of the
+ * shadow size.
+ *
+ * Only reads the shadow tables of the session, so this can run on a worker
+ * thread.
+ */
+static void shadow_image_fill(const session_t *ps, double opacity, int width,
+                              int height, xcb_image_t *ximage) {
 	int ylimit, xlimit;
 	int swidth = width + ps->cgsize;
 	int sheight = height + ps->cgsize;
@@ -447,41 +524,18 @@ static xcb_image_t *make_shadow(session_t *ps, double opacity, int width, int he
 	int x_diff;
 	int opacity_int = (int)(opacity * 25);
 
-	ximage = xcb_image_create_native(ps->c, swidth, sheight,
-	                                 XCB_IMAGE_FORMAT_Z_PIXMAP, 8, 0, 0, NULL);
-
-	if (!ximage) {
-		printf_errf("(): failed to create an X image");
-		return 0;
-	}
-
 	unsigned char *data = ximage->data;
 	uint32_t sstride = ximage->stride;
+	const unsigned char *corner =
+	    ps->shadow_corner + opacity_int * (ps->cgsize + 1) * (ps->cgsize + 1);
+	const unsigned char *top = ps->shadow_top + opacity_int * (ps->cgsize + 1);
 
 	/*
 	 * Build the gaussian in sections
-	 */
-
-	/*
-	 * center (fill the complete data array)
-	 */
-
-	// XXX If the center part of the shadow would be entirely covered by
-	// the body of the window, we shouldn't need to fill the center here.
-	// XXX In general, we want to just fill the part that is not behind
-	// the window, in order to reduce CPU load and make transparent window
-	// look correct
-	if (ps->cgsize > 0) {
-		d = ps->shadow_top[opacity_int * (ps->cgsize + 1) + ps->cgsize];
-	} else {
-		d = (unsigned char)(sum_kernel(ps->gaussian_map, center, center, width,
-		                               height) *
-		                    opacity * 255.0);
-	}
-	memset(data, d, sheight * swidth);
-
-	/*
-	 * corners
+	 *
+	 * The shadow is symmetric, and all rows outside of the corners are the
+	 * same, so each distinct row is built once and copied over, instead of
+	 * writing the sides a column at a time.
 	 */
 
 	ylimit = ps->cgsize;
@@ -492,155 +546,546 @@ static xcb_image_t *make_shadow(session_t *ps, double opacity, int width, int he
 	if (xlimit > swidth / 2)
 		xlimit = (swidth + 1) / 2;
 
+	x_diff = swidth - (ps->cgsize * 2);
+
+	/*
+	 * corners and top/bottom
+	 */
+
 	for (y = 0; y < ylimit; y++) {
+		unsigned char *row = &data[y * sstride];
 		for (x = 0; x < xlimit; x++) {
 			if (xlimit == ps->cgsize && ylimit == ps->cgsize) {
-				d = ps->shadow_corner[opacity_int * (ps->cgsize + 1) *
-				                          (ps->cgsize + 1) +
-				                      y * (ps->cgsize + 1) + x];
+				d = corner[y * (ps->cgsize + 1) + x];
 			} else {
 				d = (unsigned char)(sum_kernel(ps->gaussian_map, x - center,
 				                               y - center, width, height) *
 				                    opacity * 255.0);
 			}
-			data[y * sstride + x] = d;
-			data[(sheight - y - 1) * sstride + x] = d;
-			data[(sheight - y - 1) * sstride + (swidth - x - 1)] = d;
-			data[y * sstride + (swidth - x - 1)] = d;
+			row[x] = d;
+			row[swidth - x - 1] = d;
 		}
-	}
 
-	/*
-	 * top/bottom
-	 */
-
-	x_diff = swidth - (ps->cgsize * 2);
-	if (x_diff > 0 && ylimit > 0) {
-		for (y = 0; y < ylimit; y++) {
+		if (x_diff > 0) {
 			if (ylimit == ps->cgsize) {
-				d = ps->shadow_top[opacity_int * (ps->cgsize + 1) + y];
+				d = top[y];
 			} else {
 				d = (unsigned char)(sum_kernel(ps->gaussian_map, center,
 				                               y - center, width, height) *
 				                    opacity * 255.0);
 			}
-			memset(&data[y * sstride + ps->cgsize], d, x_diff);
-			memset(&data[(sheight - y - 1) * sstride + ps->cgsize], d, x_diff);
+			memset(&row[ps->cgsize], d, x_diff);
 		}
+
+		memcpy(&data[(sheight - y - 1) * sstride], row, swidth);
 	}
 
 	/*
-	 * sides
+	 * sides and center
 	 */
 
+	if (sheight - ps->cgsize * 2 <= 0)
+		return;
+
+	// XXX If the center part of the shadow would be entirely covered by
+	// the body of the window, we shouldn't need to fill the center here.
+	// XXX In general, we want to just fill the part that is not behind
+	// the window, in order to reduce CPU load and make transparent window
+	// look correct
+	unsigned char *row = &data[ps->cgsize * sstride];
+	if (ps->cgsize > 0) {
+		d = top[ps->cgsize];
+	} else {
+		d = (unsigned char)(sum_kernel(ps->gaussian_map, center, center, width,
+		                               height) *
+		                    opacity * 255.0);
+	}
+	memset(row, d, swidth);
+
 	for (x = 0; x < xlimit; x++) {
 		if (xlimit == ps->cgsize) {
-			d = ps->shadow_top[opacity_int * (ps->cgsize + 1) + x];
+			d = top[x];
 		} else {
 			d = (unsigned char)(sum_kernel(ps->gaussian_map, x - center,
 			                               center, width, height) *
 			                    opacity * 255.0);
 		}
-		for (y = ps->cgsize; y < sheight - ps->cgsize; y++) {
-			data[y * sstride + x] = d;
-			data[y * sstride + (swidth - x - 1)] = d;
+		row[x] = d;
+		row[swidth - x - 1] = d;
+	}
+
+	for (y = ps->cgsize + 1; y < sheight - ps->cgsize; y++)
+		memcpy(&data[y * sstride], row, swidth);
+}
+
+/**
+ * Create the image for the shadow of a window of the given size.
+ *
+ * The image data is put in a shared memory segment if possible, which is
+ * returned in <code>*pseg</code>, NULL otherwise.
+ */
+static xcb_image_t *
+shadow_image_new(session_t *ps, int width, int height, struct shm_seg **pseg) {
+	const int swidth = width + ps->cgsize, sheight = height + ps->cgsize;
+	*pseg = NULL;
+
+	// Create the image without allocating its data, to know its size
+	xcb_image_t *ximage = xcb_image_create_native(
+	    ps->c, swidth, sheight, XCB_IMAGE_FORMAT_Z_PIXMAP, 8, NULL, ~0, NULL);
+	if (ximage) {
+		*pseg = shm_seg_get(ps->shm, ximage->size);
+		if (*pseg) {
+			ximage->data = shm_seg_data(*pseg);
+			return ximage;
 		}
+		xcb_image_destroy(ximage);
 	}
 
+	ximage = xcb_image_create_native(ps->c, swidth, sheight,
+	                                 XCB_IMAGE_FORMAT_Z_PIXMAP, 8, 0, 0, NULL);
+	if (!ximage)
+		printf_errf("(): failed to create an X image");
 	return ximage;
 }
 
 /**
- * Generate shadow <code>Picture</code> for a window.
+ * Upload a part of a shadow image as the shadow mask. The shared memory
+ * segment of the image is given back, if any.
+ *
+ * XRender gets an A8 <code>Picture</code>, GLX an alpha texture. They are
+ * painted as the mask of the shadow color, see render_shadow().
+ *
+ * @param pad whether to extend the edges of the mask when painting beyond it
  */
-static bool win_build_shadow(session_t *ps, win *w, double opacity) {
-	const int width = w->widthb;
-	const int height = w->heightb;
-	// printf_errf("(): building shadow for %s %d %d", w->name, width, height);
-
-	xcb_image_t *shadow_image = NULL;
-	xcb_pixmap_t shadow_pixmap = None, shadow_pixmap_argb = None;
-	xcb_render_picture_t shadow_picture = None, shadow_picture_argb = None;
-	xcb_gcontext_t gc = None;
-
-	shadow_image = make_shadow(ps, opacity, width, height);
-	if (!shadow_image) {
-		printf_errf("(): failed to make shadow");
-		return None;
+static bool shadow_upload(session_t *ps, const xcb_image_t *shadow_image,
+                          struct shm_seg *seg, int x, int y, int width,
+                          int height, bool pad, paint_t *ppaint) {
+#ifdef CONFIG_OPENGL
+	if (BKEND_GLX == ps->o.backend) {
+		// Textures clamp to edge already
+		bool ret = glx_load_alpha_texture(
+		    ps, &ppaint->ptex, shadow_image->data + y * shadow_image->stride + x,
+		    shadow_image->stride, width, height);
+		if (seg)
+			shm_seg_release(ps->shm, seg);
+		return ret;
 	}
+#endif
 
-	shadow_pixmap =
-	    x_create_pixmap(ps, 8, ps->root, shadow_image->width, shadow_image->height);
-	shadow_pixmap_argb =
-	    x_create_pixmap(ps, 32, ps->root, shadow_image->width, shadow_image->height);
+	xcb_pixmap_t shadow_pixmap = None;
+	xcb_render_picture_t shadow_picture = None;
 
-	if (!shadow_pixmap || !shadow_pixmap_argb) {
-		printf_errf("(): failed to create shadow pixmaps");
+	shadow_pixmap = x_create_pixmap(ps, 8, ps->root, width, height);
+	if (!shadow_pixmap) {
+		printf_errf("(): failed to create shadow pixmap");
 		goto shadow_picture_err;
 	}
 
+	const xcb_render_create_picture_value_list_t pa = {
+	    .repeat = XCB_RENDER_REPEAT_PAD,
+	};
 	shadow_picture = x_create_picture_with_standard_and_pixmap(
-	    ps, XCB_PICT_STANDARD_A_8, shadow_pixmap, 0, NULL);
-	shadow_picture_argb = x_create_picture_with_standard_and_pixmap(
-	    ps, XCB_PICT_STANDARD_ARGB_32, shadow_pixmap_argb, 0, NULL);
-	if (!shadow_picture || !shadow_picture_argb)
+	    ps, XCB_PICT_STANDARD_A_8, shadow_pixmap, pad ? XCB_RENDER_CP_REPEAT : 0,
+	    pad ? &pa : NULL);
+	if (!shadow_picture)
 		goto shadow_picture_err;
 
-	gc = xcb_generate_id(ps->c);
+	xcb_gcontext_t gc = xcb_generate_id(ps->c);
 	xcb_create_gc(ps->c, gc, shadow_pixmap, 0, NULL);
+	if (seg)
+		shm_seg_put(ps->shm, seg, shadow_pixmap, gc, shadow_image, -x, -y);
+	else
+		xcb_image_put(ps->c, shadow_pixmap, gc, (xcb_image_t *)shadow_image,
+		              -x, -y, 0);
+	xcb_free_gc(ps->c, gc);
 
-	xcb_image_put(ps->c, shadow_pixmap, gc, shadow_image, 0, 0, 0);
-	xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, ps->cshadow_picture,
-	                     shadow_picture, shadow_picture_argb, 0, 0, 0, 0, 0, 0,
-	                     shadow_image->width, shadow_image->height);
-
-	assert(!w->shadow_paint.pixmap);
-	w->shadow_paint.pixmap = shadow_pixmap_argb;
-	assert(!w->shadow_paint.pict);
-	w->shadow_paint.pict = shadow_picture_argb;
+	assert(!ppaint->pixmap);
+	ppaint->pixmap = shadow_pixmap;
+	assert(!ppaint->pict);
+	ppaint->pict = shadow_picture;
 
 	// Sync it once and only once
-	xr_sync(ps, w->shadow_paint.pixmap, NULL);
-
-	xcb_free_gc(ps->c, gc);
-	xcb_image_destroy(shadow_image);
-	xcb_free_pixmap(ps->c, shadow_pixmap);
-	xcb_render_free_picture(ps->c, shadow_picture);
+	xr_sync(ps, ppaint->pixmap, NULL);
 
 	return true;
 
 shadow_picture_err:
-	if (shadow_image)
-		xcb_image_destroy(shadow_image);
+	if (seg)
+		shm_seg_release(ps->shm, seg);
 	if (shadow_pixmap)
 		xcb_free_pixmap(ps->c, shadow_pixmap);
-	if (shadow_pixmap_argb)
-		xcb_free_pixmap(ps->c, shadow_pixmap_argb);
-	if (shadow_picture)
-		xcb_render_free_picture(ps->c, shadow_picture);
-	if (shadow_picture_argb)
-		xcb_render_free_picture(ps->c, shadow_picture_argb);
-	if (gc)
-		xcb_free_gc(ps->c, gc);
 
 	return false;
 }
 
+/**
+ * Check whether a shadow mask from shadow_upload() is usable.
+ */
+static inline bool shadow_paint_isvalid(session_t *ps, const paint_t *ppaint) {
+#ifdef CONFIG_OPENGL
+	if (BKEND_GLX == ps->o.backend)
+		return ppaint->ptex && ppaint->ptex->texture;
+#endif
+	return ppaint->pict;
+}
+
+static xcb_render_picture_t
+solid_picture(session_t *ps, bool argb, double a, double r, double g, double b);
+
+/**
+ * Get the 1x1 <code>Picture</code> of the shadow color at an opacity step.
+ */
+static xcb_render_picture_t shadow_color_pict(session_t *ps, int alpha_step) {
+	xcb_render_picture_t *pict = &ps->cshadow_picts[alpha_step];
+	if (!*pict) {
+		double o = (double)alpha_step / MAX_ALPHA;
+		*pict = solid_picture(ps, true, o, ps->o.shadow_red * o,
+		                      ps->o.shadow_green * o, ps->o.shadow_blue * o);
+	}
+	return *pict;
+}
+
+/**
+ * Paint a shadow mask with the shadow color, like render() does for
+ * textures.
+ */
+static void render_shadow(session_t *ps, int x, int y, int dx, int dy, int wid,
+                          int hei, double opacity, const paint_t *ppaint,
+                          const region_t *reg_paint) {
+	switch (ps->o.backend) {
+	case BKEND_XRENDER:
+	case BKEND_XR_GLX_HYBRID: {
+		int alpha_step = opacity * MAX_ALPHA;
+		if (alpha_step != 0)
+			xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_OVER,
+			                     shadow_color_pict(ps, alpha_step), ppaint->pict,
+			                     ps->tgt_buffer.pict, 0, 0, x, y, dx, dy, wid,
+			                     hei);
+		break;
+	}
+#ifdef CONFIG_OPENGL
+	case BKEND_GLX:
+		glx_render_shadow(ps, ppaint->ptex, x, y, dx, dy, wid, hei,
+		                  ps->psglx->z, opacity, reg_paint);
+		glx_z_next(ps);
+		break;
+#endif
+	default: assert(0);
+	}
+}
+
+/// Key of a shadow in the shadow cache, 0 if the size can't be cached
+static inline uint32_t shadow_key(int width, int height) {
+	if (width <= 0 || height <= 0 || width > 0xffff || height > 0xffff)
+		return 0;
+	return (uint32_t)width << 16 | (uint32_t)height;
+}
+
+/// Unlink a shadow from the LRU list of unused shadows
+static void shadow_lru_remove(shadow_cache_t *sc, shadow_t *s) {
+	if (s->lru_prev)
+		s->lru_prev->lru_next = s->lru_next;
+	else
+		sc->lru_head = s->lru_next;
+	if (s->lru_next)
+		s->lru_next->lru_prev = s->lru_prev;
+	else
+		sc->lru_tail = s->lru_prev;
+	s->lru_prev = s->lru_next = NULL;
+	sc->unused_size -= s->size;
+}
+
+static void shadow_destroy(session_t *ps, shadow_t *s) {
+	if (s->cached)
+		idmap_remove(&ps->shadow_cache.map,
+		             shadow_key(s->width, s->height), s);
+	free_paint(ps, &s->paint);
+	free(s);
+}
+
+/// A shadow image being built on a worker thread
+struct shadow_job {
+	session_t *ps;
+	/// The shadow being built, the job holds a reference to it
+	shadow_t *shadow;
+	xcb_image_t *image;
+	/// Shared memory segment the image data lives in, if any
+	struct shm_seg *seg;
+};
+
+static void shadow_job_work(void *data) {
+	struct shadow_job *job = data;
+	shadow_image_fill(job->ps, 1, job->shadow->width, job->shadow->height,
+	                  job->image);
+}
+
+static void shadow_job_done(void *data) {
+	struct shadow_job *job = data;
+	session_t *ps = job->ps;
+
+	if (!shadow_upload(ps, job->image, job->seg, 0, 0, job->image->width,
+	                   job->image->height, false, &job->shadow->paint))
+		printf_errf("(): build shadow failed");
+	xcb_image_destroy(job->image);
+	job->shadow->ready = true;
+	shadow_release(ps, &job->shadow);
+	free(job);
+
+	queue_redraw(ps);
+}
+
+/**
+ * Get the shadow for a window of the given size. If there isn't one in the
+ * cache, a new one is built in the background, it can't be painted before it
+ * is <code>ready</code>.
+ *
+ * The shadow is only determined by the size of the window, since shadow
+ * radius, color and opacity are the same for all windows.
+ */
+static shadow_t *shadow_get(session_t *ps, int width, int height) {
+	shadow_cache_t *sc = &ps->shadow_cache;
+	const uint32_t key = shadow_key(width, height);
+
+	shadow_t *s = key ? idmap_get(&sc->map, key) : NULL;
+	if (s) {
+		sc->hits++;
+		if (!s->refcount++)
+			shadow_lru_remove(sc, s);
+		return s;
+	}
+
+	sc->misses++;
+	struct shm_seg *seg;
+	xcb_image_t *image = shadow_image_new(ps, width, height, &seg);
+	if (!image)
+		return NULL;
+
+	s = ccalloc(1, shadow_t);
+	s->paint = (paint_t)PAINT_INIT;
+	s->width = width;
+	s->height = height;
+	// One for the caller, one for the job
+	s->refcount = 2;
+	s->size = (size_t)(width + ps->cgsize) * (size_t)(height + ps->cgsize);
+	if (key) {
+		idmap_set(&sc->map, key, s);
+		s->cached = true;
+	}
+
+	auto job = cmalloc(struct shadow_job);
+	job->ps = ps;
+	job->shadow = s;
+	job->image = image;
+	job->seg = seg;
+	worker_submit(ps->workers, shadow_job_work, shadow_job_done, job);
+	return s;
+}
+
+/**
+ * Whether shadows are drawn by a fragment shader, see glx_init_shadow(). No
+ * shadow images are needed then.
+ */
+static inline bool shadow_analytic(session_t *ps) {
+#ifdef CONFIG_OPENGL
+	return ps->o.backend == BKEND_GLX && ps->o.glx_analytic_shadow;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Whether the shadow of a window is drawn from the shadow quadrants.
+ *
+ * The corners of shadow_image_fill()'s output only depend on the window size when
+ * the window is smaller than the shadow radius, beyond that the edges are just
+ * longer.
+ */
+static inline bool win_shadow_sliced(session_t *ps, win *w) {
+	return ps->cgsize > 0 && w->widthb >= ps->cgsize && w->heightb >= ps->cgsize;
+}
+
+/**
+ * Build the shadow quadrants, see <code>shadow_cache_t</code>.
+ */
+static bool shadow_quadrants_build(session_t *ps) {
+	paint_t *quads = ps->shadow_cache.quadrants;
+	const int c = ps->cgsize;
+	bool ret = true;
+
+	// A shadow (2c+1) pixels wide, each quadrant shares its middle row and
+	// column
+	struct shm_seg *seg;
+	xcb_image_t *image = shadow_image_new(ps, c + 1, c + 1, &seg);
+	if (!image) {
+		printf_errf("(): failed to make shadow");
+		return false;
+	}
+	shadow_image_fill(ps, 1, c + 1, c + 1, image);
+
+	for (int i = 0; i < 4; i++) {
+		// The segment is given back by the last upload, earlier ones read
+		// the image data from it like from any other memory
+		if (!shadow_upload(ps, image, i == 3 ? seg : NULL, (i & 1) * c,
+		                   (i >> 1) * c, c + 1, c + 1, true, &quads[i])) {
+			printf_errf("(): failed to create shadow quadrants");
+			if (seg && i < 3)
+				shm_seg_release(ps->shm, seg);
+			ret = false;
+			break;
+		}
+	}
+
+	if (!ret)
+		for (int i = 0; i < 4; i++)
+			free_paint(ps, &quads[i]);
+	xcb_image_destroy(image);
+	return ret;
+}
+
+/**
+ * Paint the shadow of a window from the shadow quadrants, stretching their
+ * inner edges over the rest of the shadow.
+ */
+static void win_paint_shadow_sliced(session_t *ps, win *w, region_t *reg_paint) {
+	paint_t *quads = ps->shadow_cache.quadrants;
+	if (!shadow_paint_isvalid(ps, &quads[0]) && !shadow_quadrants_build(ps))
+		return;
+
+	const int c = ps->cgsize;
+	const int x = w->g.x + w->shadow_dx, y = w->g.y + w->shadow_dy;
+	const int splitx = w->shadow_width / 2, splity = w->shadow_height / 2;
+	for (int i = 0; i < 4; i++) {
+		const bool right = i & 1, bottom = i >> 1;
+		// Where the quadrant goes in the shadow
+		const int qx = right ? w->shadow_width - c - 1 : 0;
+		const int qy = bottom ? w->shadow_height - c - 1 : 0;
+		// The part of the shadow it covers
+		const int dx = right ? splitx : 0, dy = bottom ? splity : 0;
+		const int wid = right ? w->shadow_width - splitx : splitx;
+		const int hei = bottom ? w->shadow_height - splity : splity;
+
+		render_shadow(ps, dx - qx, dy - qy, x + dx, y + dy, wid, hei,
+		              w->shadow_opacity, &quads[i], reg_paint);
+	}
+}
+
+/**
+ * Drop a reference to a shadow.
+ *
+ * Shadows no longer used are kept in the cache, until the memory used by them
+ * exceeds <code>SHADOW_CACHE_BUDGET</code>, then the least recently used ones
+ * are freed.
+ */
+void shadow_release(session_t *ps, shadow_t **pshadow) {
+	shadow_t *s = *pshadow;
+	*pshadow = NULL;
+	if (!s || --s->refcount)
+		return;
+
+	if (!s->cached) {
+		shadow_destroy(ps, s);
+		return;
+	}
+
+	shadow_cache_t *sc = &ps->shadow_cache;
+	s->lru_prev = NULL;
+	s->lru_next = sc->lru_head;
+	if (sc->lru_head)
+		sc->lru_head->lru_prev = s;
+	else
+		sc->lru_tail = s;
+	sc->lru_head = s;
+	sc->unused_size += s->size;
+
+	while (sc->unused_size > SHADOW_CACHE_BUDGET) {
+		shadow_t *victim = sc->lru_tail;
+		shadow_lru_remove(sc, victim);
+		shadow_destroy(ps, victim);
+	}
+}
+
+/**
+ * Make sure a shadow of the current size of a window is built or being built,
+ * and switch to it once it's ready. Until then, the previous shadow of the
+ * window is painted.
+ */
+static void win_update_shadow(session_t *ps, win *w) {
+	if (shadow_analytic(ps) || win_shadow_sliced(ps, w)) {
+		shadow_release(ps, &w->shadow_paint);
+		shadow_release(ps, &w->shadow_pending);
+		return;
+	}
+
+	shadow_t *s = w->shadow_paint;
+	if (s && s->width == w->widthb && s->height == w->heightb) {
+		shadow_release(ps, &w->shadow_pending);
+		return;
+	}
+
+	s = w->shadow_pending;
+	if (s && (s->width != w->widthb || s->height != w->heightb))
+		shadow_release(ps, &w->shadow_pending);
+	if (!w->shadow_pending) {
+		w->shadow_pending = shadow_get(ps, w->widthb, w->heightb);
+		if (!w->shadow_pending) {
+			printf_errf("(): build shadow failed");
+			return;
+		}
+	}
+
+	if (w->shadow_pending->ready) {
+		shadow_release(ps, &w->shadow_paint);
+		w->shadow_paint = w->shadow_pending;
+		w->shadow_pending = NULL;
+	}
+}
+
+/**
+ * Paint the analytic shadows added since the last call, with one draw call.
+ * Shadows of windows that paint nothing in between are batched this way.
+ */
+static inline void win_flush_shadows(session_t *ps) {
+#ifdef CONFIG_OPENGL
+	if (shadow_analytic(ps))
+		glx_shadows_flush(ps);
+#endif
+}
+
 /**
  * Paint the shadow of a window.
  */
 static inline void win_paint_shadow(session_t *ps, win *w, region_t *reg_paint) {
-	// Bind shadow pixmap to GLX texture if needed
-	paint_bind_tex(ps, &w->shadow_paint, 0, 0, 32, false);
+#ifdef CONFIG_OPENGL
+	if (shadow_analytic(ps)) {
+		const int x = w->g.x + w->shadow_dx, y = w->g.y + w->shadow_dy;
+		const int center = ps->cgsize / 2;
+		glx_render_shadow_analytic(ps, x + center, y + center, w->widthb,
+		                           w->heightb, x, y, w->shadow_width,
+		                           w->shadow_height, ps->psglx->z,
+		                           w->shadow_opacity, reg_paint);
+		glx_z_next(ps);
+		return;
+	}
+#endif
+
+	if (win_shadow_sliced(ps, w)) {
+		win_paint_shadow_sliced(ps, w, reg_paint);
+		return;
+	}
 
-	if (!paint_isvalid(ps, &w->shadow_paint)) {
+	// The first shadow of the window may still be being built
+	if (!w->shadow_paint)
+		return;
+	paint_t *ppaint = &w->shadow_paint->paint;
+
+	if (!shadow_paint_isvalid(ps, ppaint)) {
 		printf_errf("(%#010lx): Missing shadow data.", w->id);
 		return;
 	}
 
-	render(ps, 0, 0, w->g.x + w->shadow_dx, w->g.y + w->shadow_dy, w->shadow_width,
-	       w->shadow_height, w->shadow_opacity, true, false, w->shadow_paint.pict,
-	       w->shadow_paint.ptex, reg_paint, NULL);
+	render_shadow(ps, 0, 0, w->g.x + w->shadow_dx, w->g.y + w->shadow_dy,
+	              w->shadow_width, w->shadow_height, w->shadow_opacity, ppaint,
+	              reg_paint);
 }
 
 /**
@@ -659,7 +1104,7 @@ static inline void normalize_conv_kern(int wid, int hei, xcb_render_fixed_t *ker
  * @brief Blur an area on a buffer.
  *
  * @param ps current session
- * @param tgt_buffer a buffer as both source and destination
+ * @param tgt_buffer a buffer as the source
  * @param x x pos
  * @param y y pos
  * @param wid width
@@ -667,12 +1112,20 @@ static inline void normalize_conv_kern(int wid, int hei, xcb_render_fixed_t *ker
  * @param blur_kerns blur kernels, ending with a NULL, guaranteed to have at
  *                    least one kernel
  * @param reg_clip a clipping region to be applied on intermediate buffers
+ * @param dst_buffer the buffer the blurred area is written to, may be
+ *                   tgt_buffer
+ * @param dst_x x pos in dst_buffer
+ * @param dst_y y pos in dst_buffer
+ * @param blend how much of the blurred area is mixed into dst_buffer, which
+ *              must hold the area unblurred if it's less than 1
  *
  * @return true if successful, false otherwise
  */
 static bool
 xr_blur_dst(session_t *ps, xcb_render_picture_t tgt_buffer, int x, int y, int wid,
-            int hei, xcb_render_fixed_t **blur_kerns, const region_t *reg_clip) {
+            int hei, xcb_render_fixed_t **blur_kerns, const region_t *reg_clip,
+            xcb_render_picture_t dst_buffer, int dst_x, int dst_y,
+            double blend) {
 	assert(blur_kerns[0]);
 
 	// Directly copying from tgt_buffer to it does not work, so we create a
@@ -687,13 +1140,22 @@ xr_blur_dst(session_t *ps, xcb_render_picture_t tgt_buffer, int x, int y, int wi
 	if (reg_clip && tmp_picture)
 		x_set_picture_clip_region(ps, tmp_picture, 0, 0, reg_clip);
 
+	// The last write to dst_buffer mixes the blurred area into it
+	const int alpha_step = blend * MAX_ALPHA;
+	const xcb_render_picture_t mix_mask =
+	    alpha_step < MAX_ALPHA ? ps->alpha_picts[alpha_step] : XCB_NONE;
+	const uint8_t mix_op =
+	    mix_mask ? XCB_RENDER_PICT_OP_OVER : XCB_RENDER_PICT_OP_SRC;
+
+	// Passes alternate between the intermediate Picture and dst_buffer, the
+	// first one reads from tgt_buffer
 	xcb_render_picture_t src_pict = tgt_buffer, dst_pict = tmp_picture;
+	int src_x = x, src_y = y, dst_pict_x = 0, dst_pict_y = 0;
 	for (int i = 0; blur_kerns[i]; ++i) {
 		assert(i < MAX_BLUR_PASS - 1);
 		xcb_render_fixed_t *convolution_blur = blur_kerns[i];
 		int kwid = XFIXED_TO_DOUBLE(convolution_blur[0]),
 		    khei = XFIXED_TO_DOUBLE(convolution_blur[1]);
-		bool rd_from_tgt = (tgt_buffer == src_pict);
 
 		// Copy from source picture to destination. The filter must
 		// be applied on source picture, to get the nearby pixels outside the
@@ -701,46 +1163,202 @@ xr_blur_dst(session_t *ps, xcb_render_picture_t tgt_buffer, int x, int y, int wi
 		xcb_render_set_picture_filter(
 		    ps->c, src_pict, strlen(XRFILTER_CONVOLUTION), XRFILTER_CONVOLUTION,
 		    kwid * khei + 2, convolution_blur);
-		xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, src_pict, None,
-		                     dst_pict, (rd_from_tgt ? x : 0),
-		                     (rd_from_tgt ? y : 0), 0, 0, (rd_from_tgt ? 0 : x),
-		                     (rd_from_tgt ? 0 : y), wid, hei);
+		const bool mix = dst_pict == dst_buffer && !blur_kerns[i + 1];
+		xcb_render_composite(ps->c, mix ? mix_op : XCB_RENDER_PICT_OP_SRC,
+		                     src_pict, mix ? mix_mask : XCB_NONE, dst_pict,
+		                     src_x, src_y, 0, 0, dst_pict_x, dst_pict_y, wid,
+		                     hei);
 		xrfilter_reset(ps, src_pict);
 
-		{
-			xcb_render_picture_t tmp = src_pict;
-			src_pict = dst_pict;
-			dst_pict = tmp;
+		src_pict = dst_pict;
+		src_x = dst_pict_x;
+		src_y = dst_pict_y;
+		if (dst_pict == tmp_picture) {
+			dst_pict = dst_buffer;
+			dst_pict_x = dst_x;
+			dst_pict_y = dst_y;
+		} else {
+			dst_pict = tmp_picture;
+			dst_pict_x = dst_pict_y = 0;
 		}
 	}
 
-	if (src_pict != tgt_buffer)
-		xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC, src_pict, None,
-		                     tgt_buffer, 0, 0, 0, 0, x, y, wid, hei);
+	if (src_pict == tmp_picture)
+		xcb_render_composite(ps->c, mix_op, src_pict, mix_mask, dst_buffer, 0,
+		                     0, 0, 0, dst_x, dst_y, wid, hei);
 
 	free_picture(ps->c, &tmp_picture);
 
 	return true;
 }
 
+/**
+ * Get how far the blur reaches, the sum of the radii of all blur passes, or
+ * the spread of the dual Kawase blur.
+ */
+static inline void blur_radius(session_t *ps, int *rx, int *ry) {
+#ifdef CONFIG_OPENGL
+	if (ps->o.blur_method == BLUR_METHOD_DUAL_KAWASE) {
+		*rx = *ry = glx_kawase_radius(ps);
+		return;
+	}
+#endif
+	*rx = *ry = 0;
+	for (int i = 0; i < MAX_BLUR_PASS && ps->o.blur_kerns[i]; ++i) {
+		*rx += XFIXED_TO_DOUBLE(ps->o.blur_kerns[i][0]) / 2;
+		*ry += XFIXED_TO_DOUBLE(ps->o.blur_kerns[i][1]) / 2;
+	}
+}
+
+/**
+ * Get the area to blur to get a region of a window blurred, the region grown
+ * by the blur radius and kept inside the window. In window local coordinates.
+ */
+static inline pixman_box32_t
+blur_area(const region_t *reg, int rx, int ry, int wid, int hei) {
+	const pixman_box32_t *ext = pixman_region32_extents((region_t *)reg);
+	return (pixman_box32_t){
+	    .x1 = max_i(ext->x1 - rx, 0),
+	    .y1 = max_i(ext->y1 - ry, 0),
+	    .x2 = min_i(ext->x2 + rx, wid),
+	    .y2 = min_i(ext->y2 + ry, hei),
+	};
+}
+
+/**
+ * Factor of the center element of the blur kernel for a window.
+ */
+static inline double win_blur_factor_center(session_t *ps, win *w) {
+	// Adjust blur strength according to window opacity, to make it appear
+	// better during fading
+	if (!ps->o.blur_background_fixed &&
+	    ps->o.blur_method == BLUR_METHOD_KERNEL) {
+		double pct = 1.0 - get_opacity_percent(w) * (1.0 - 1.0 / 9.0);
+		return pct * 8.0 / (1.1 - pct);
+	}
+	return 1.0;
+}
+
+/**
+ * Drop the parts of the blurred background kept for a window which were
+ * blurred from damaged pixels.
+ *
+ * @param reg_damage damage which may have changed the background of the
+ *                   window
+ * @param reg_changed returns the part of the window whose blurred background
+ *                    changed, in global coordinates
+ */
+static void win_blur_cache_invalidate(session_t *ps, win *w,
+                                      const region_t *reg_damage,
+                                      region_t *reg_changed) {
+	const int wx = w->g.x, wy = w->g.y;
+	const int wid = w->widthb, hei = w->heightb;
+	const double factor_center = win_blur_factor_center(ps, w);
+	pixman_region32_clear(reg_changed);
+
+	// Moving, resizing or fading the window damages all of it already
+	if (w->blur_cache_x != wx || w->blur_cache_y != wy ||
+	    w->blur_cache_width != wid || w->blur_cache_height != hei ||
+	    w->blur_cache_factor != factor_center) {
+		pixman_region32_clear(&w->blur_cache_valid);
+		// The Picture the blur is kept in has the size of the window
+		if (w->blur_cache_width != wid || w->blur_cache_height != hei)
+			free_picture(ps->c, &w->blur_cache_pict);
+		w->blur_cache_x = wx;
+		w->blur_cache_y = wy;
+		w->blur_cache_width = wid;
+		w->blur_cache_height = hei;
+		w->blur_cache_factor = factor_center;
+		return;
+	}
+
+	int rx, ry;
+	blur_radius(ps, &rx, &ry);
+	int nrects;
+	const rect_t *rects =
+	    pixman_region32_rectangles((region_t *)reg_damage, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		const int x1 = max_i(rects[i].x1 - rx, wx);
+		const int y1 = max_i(rects[i].y1 - ry, wy);
+		const int x2 = min_i(rects[i].x2 + rx, wx + wid);
+		const int y2 = min_i(rects[i].y2 + ry, wy + hei);
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+		pixman_region32_union_rect(reg_changed, reg_changed, x1, y1,
+		                           x2 - x1, y2 - y1);
+	}
+	if (!pixman_region32_not_empty(reg_changed))
+		return;
+
+	// The blurred background is only painted inside the window shape
+	region_t bshape = win_get_bounding_shape_global_by_val(w);
+	pixman_region32_intersect(reg_changed, reg_changed, &bshape);
+	pixman_region32_fini(&bshape);
+
+	pixman_region32_translate(reg_changed, -wx, -wy);
+	pixman_region32_subtract(&w->blur_cache_valid, &w->blur_cache_valid,
+	                         reg_changed);
+	pixman_region32_translate(reg_changed, wx, wy);
+}
+
 /**
  * Blur the background of a window.
+ *
+ * The blurred background is kept across frames. It stays valid as long as the
+ * window doesn't move, resize or change its blur strength, and nothing
+ * beneath it is damaged within the blur radius, see paint_blur_invalidate().
+ * Only the part of the window being painted that isn't valid is blurred
+ * again, which needs the pixels within the blur radius around it.
  */
 static inline void
 win_blur_background(session_t *ps, win *w, xcb_render_picture_t tgt_buffer,
                     const region_t *reg_paint) {
-	const int x = w->g.x;
-	const int y = w->g.y;
-	const int wid = w->widthb;
-	const int hei = w->heightb;
+	const int wx = w->g.x, wy = w->g.y;
+	const int wid = w->widthb, hei = w->heightb;
+
+	// Minimize the region we try to blur, if the window itself is not
+	// opaque, only the frame is.
+	// TODO: Handle frame opacity with GLX
+	region_t reg_blur = win_get_bounding_shape_global_by_val(w);
+	if (BKEND_GLX != ps->o.backend && win_is_solid(ps, w)) {
+		region_t reg_noframe;
+		pixman_region32_init(&reg_noframe);
+		win_get_region_noframe_local(w, &reg_noframe);
+		pixman_region32_translate(&reg_noframe, wx, wy);
+		pixman_region32_subtract(&reg_blur, &reg_blur, &reg_noframe);
+		pixman_region32_fini(&reg_noframe);
+	}
 
-	double factor_center = 1.0;
-	// Adjust blur strength according to window opacity, to make it appear
-	// better during fading
-	if (!ps->o.blur_background_fixed) {
-		double pct = 1.0 - get_opacity_percent(w) * (1.0 - 1.0 / 9.0);
-		factor_center = pct * 8.0 / (1.1 - pct);
+	// The part of the blurred background painted, in window local coordinates
+	region_t reg_need;
+	pixman_region32_init(&reg_need);
+	pixman_region32_intersect(&reg_need, &reg_blur, (region_t *)reg_paint);
+	if (!pixman_region32_not_empty(&reg_need)) {
+		pixman_region32_fini(&reg_need);
+		pixman_region32_fini(&reg_blur);
+		return;
 	}
+	pixman_region32_translate(&reg_need, -wx, -wy);
+	pixman_region32_translate(&reg_blur, -wx, -wy);
+
+	double factor_center = win_blur_factor_center(ps, w);
+	int rx, ry;
+	blur_radius(ps, &rx, &ry);
+
+	// A split kernel is applied with its center element as 1, the blur
+	// strength is adjusted by mixing the blurred background with the
+	// unblurred one instead, which is the same as changing the center element
+	// of the whole kernel. Only a weaker blur can be mixed, a center element
+	// less than 1 is taken as 1.
+	double blend = 1.0;
+	if (ps->o.blur_kern_split_sum > 0) {
+		const double sum = ps->o.blur_kern_split_sum;
+		blend = normalize_d(sum / (sum + factor_center - 1.0));
+		factor_center = 1.0;
+	}
+
+	region_t reg_missing;
+	pixman_region32_init(&reg_missing);
 
 	switch (ps->o.backend) {
 	case BKEND_XRENDER:
@@ -771,7 +1389,7 @@ win_blur_background(session_t *ps, win *w, xcb_render_picture_t tgt_buffer,
 				if (!kern_dst) {
 					printf_errf("(): Failed to allocate memory "
 					            "for blur kernel.");
-					return;
+					goto win_blur_background_end;
 				}
 				ps->blur_kerns_cache[i] = kern_dst;
 			}
@@ -786,34 +1404,202 @@ win_blur_background(session_t *ps, win *w, xcb_render_picture_t tgt_buffer,
 			normalize_conv_kern(kwid, khei, kern_dst + 2);
 		}
 
-		// Minimize the region we try to blur, if the window itself is not
-		// opaque, only the frame is.
-		region_t reg_blur = win_get_bounding_shape_global_by_val(w);
-		if (win_is_solid(ps, w)) {
-			region_t reg_noframe;
-			pixman_region32_init(&reg_noframe);
-			win_get_region_noframe_local(w, &reg_noframe);
-			pixman_region32_translate(&reg_noframe, w->g.x, w->g.y);
-			pixman_region32_subtract(&reg_blur, &reg_blur, &reg_noframe);
-			pixman_region32_fini(&reg_noframe);
+		if (!w->blur_cache_pict) {
+			pixman_region32_clear(&w->blur_cache_valid);
+			w->blur_cache_pict = x_create_picture(ps, wid, hei, NULL, 0, NULL);
+		}
+		// Without a Picture to keep it in, the background is blurred
+		// straight into the buffer
+		const bool cached = w->blur_cache_pict;
+		if (cached)
+			x_set_picture_clip_region(ps, w->blur_cache_pict, 0, 0, &reg_blur);
+
+		pixman_region32_subtract(&reg_missing, &reg_need, &w->blur_cache_valid);
+		if (pixman_region32_not_empty(&reg_missing)) {
+			const pixman_box32_t area = blur_area(&reg_missing, rx, ry, wid, hei);
+			// Translate window local coordinates to ones in the blurred area
+			region_t reg_clip;
+			pixman_region32_init(&reg_clip);
+			copy_region(&reg_clip, &reg_blur);
+			pixman_region32_translate(&reg_clip, -area.x1, -area.y1);
+			// The blurred background is mixed with the unblurred one
+			if (cached && blend < 1.0)
+				xcb_render_composite(
+				    ps->c, XCB_RENDER_PICT_OP_SRC, tgt_buffer, None,
+				    w->blur_cache_pict, wx + area.x1, wy + area.y1, 0, 0,
+				    area.x1, area.y1, area.x2 - area.x1, area.y2 - area.y1);
+			xr_blur_dst(ps, tgt_buffer, wx + area.x1, wy + area.y1,
+			            area.x2 - area.x1, area.y2 - area.y1,
+			            ps->blur_kerns_cache, &reg_clip,
+			            cached ? w->blur_cache_pict : tgt_buffer,
+			            cached ? area.x1 : wx + area.x1,
+			            cached ? area.y1 : wy + area.y1, blend);
+			pixman_region32_fini(&reg_clip);
+
+			// Only what's painted is read from the buffer, the rest
+			// of the blurred area isn't reliable
+			if (cached)
+				pixman_region32_union(&w->blur_cache_valid,
+				                      &w->blur_cache_valid, &reg_missing);
+		}
+
+		if (cached) {
+			const pixman_box32_t *ext = pixman_region32_extents(&reg_need);
+			xcb_render_composite(ps->c, XCB_RENDER_PICT_OP_SRC,
+			                     w->blur_cache_pict, None, tgt_buffer,
+			                     ext->x1, ext->y1, 0, 0, wx + ext->x1,
+			                     wy + ext->y1, ext->x2 - ext->x1,
+			                     ext->y2 - ext->y1);
 		}
-		// Translate global coordinates to local ones
-		pixman_region32_translate(&reg_blur, -x, -y);
-		xr_blur_dst(ps, tgt_buffer, x, y, wid, hei, ps->blur_kerns_cache,
-		            &reg_blur);
-		pixman_region32_clear(&reg_blur);
 	} break;
 #ifdef CONFIG_OPENGL
-	case BKEND_GLX:
-		// TODO: Handle frame opacity
-		glx_blur_dst(ps, x, y, wid, hei, ps->psglx->z - 0.5, factor_center,
-		             reg_paint, &w->glx_blur_cache);
-		break;
+	case BKEND_GLX: {
+		glx_blur_cache_t *pbc = &w->glx_blur_cache;
+		if (!pbc->result || pbc->result_width != wid || pbc->result_height != hei)
+			pixman_region32_clear(&w->blur_cache_valid);
+
+		pixman_region32_subtract(&reg_missing, &reg_need, &w->blur_cache_valid);
+		if (pixman_region32_not_empty(&reg_missing)) {
+			const pixman_box32_t area = blur_area(&reg_missing, rx, ry, wid, hei);
+			pixman_region32_translate(&reg_missing, wx, wy);
+			glx_blur_dst(ps, wx + area.x1, wy + area.y1, area.x2 - area.x1,
+			             area.y2 - area.y1, ps->psglx->z - 0.5,
+			             factor_center, blend, &reg_missing, pbc);
+			const bool stored =
+			    glx_blur_cache_store(ps, pbc, wx, wy, wid, hei, &reg_missing);
+			pixman_region32_translate(&reg_missing, -wx, -wy);
+			if (stored)
+				pixman_region32_union(&w->blur_cache_valid,
+				                      &w->blur_cache_valid, &reg_missing);
+		}
+
+		// Paint the rest from what was kept
+		pixman_region32_subtract(&reg_need, &reg_need, &reg_missing);
+		if (pixman_region32_not_empty(&reg_need)) {
+			pixman_region32_translate(&reg_need, wx, wy);
+			glx_blur_cache_paint(ps, pbc, wx, wy, ps->psglx->z - 0.5,
+			                     &reg_need);
+		}
+	} break;
 #endif
 	default: assert(0);
 	}
+
+win_blur_background_end:
+	pixman_region32_fini(&reg_missing);
+	pixman_region32_fini(&reg_need);
+	pixman_region32_fini(&reg_blur);
+}
+
+/// Whether the background of a window is blurred when it's painted
+static inline bool win_blurs_background(session_t *ps, win *w) {
+	return w->blur_background &&
+	       (!win_is_solid(ps, w) ||
+	        (ps->o.blur_background_frame && w->frame_opacity != 1));
 }
 
+/**
+ * Bring the blurred backgrounds kept for windows up to date with the damage
+ * of a frame, before it's painted.
+ *
+ * Damage beneath a window changes its blurred background within the blur
+ * radius around the damage. That part is added to the damage, so it's painted
+ * again even if the window isn't painted where the damage itself is.
+ */
+void paint_blur_invalidate(session_t *ps, region_t *damage, win *const t) {
+	if (!ps->o.blur_background)
+		return;
+
+	// Damage which may have changed the background of the window
+	region_t reg_bg_damage, reg_changed;
+	pixman_region32_init(&reg_bg_damage);
+	pixman_region32_init(&reg_changed);
+	copy_region(&reg_bg_damage, &ps->all_damage_other);
+	for (win *w = t; w; w = w->prev_trans) {
+		if (win_blurs_background(ps, w)) {
+			win_blur_cache_invalidate(ps, w, &reg_bg_damage, &reg_changed);
+			pixman_region32_union(damage, damage, &reg_changed);
+			pixman_region32_union(&reg_bg_damage, &reg_bg_damage,
+			                      &reg_changed);
+		}
+
+		// Changes to the content of the window change the background of
+		// the windows above it
+		pixman_region32_union(&reg_bg_damage, &reg_bg_damage,
+		                      &w->damage_content);
+	}
+	pixman_region32_fini(&reg_changed);
+	pixman_region32_fini(&reg_bg_damage);
+}
+
+#ifdef CONFIG_OPENGL
+/**
+ * Paint the solid windows front to back, writing the depth buffer, so what
+ * they cover is rejected by the depth test when the rest of the frame is
+ * painted back to front.
+ *
+ * The i-th window from the bottom is painted at z 2i + 2, its shadow and
+ * blurred background below that. Solid windows above a window whose
+ * background is blurred are left to the back to front pass, the blur must
+ * not see them.
+ *
+ * @return the number of windows from the bottom whose solid ones have been
+ *         painted, -1 if the depth test isn't used
+ */
+static int paint_solid_front_to_back(session_t *ps, region_t *region, win *t) {
+	if (!ps->o.glx_front_to_back || !t)
+		return -1;
+
+	int n = 0, nsolid = -1;
+	for (win *w = t; w; w = w->prev_trans, ++n)
+		if (nsolid < 0 && win_blurs_background(ps, w))
+			nsolid = n;
+	if (nsolid < 0)
+		nsolid = n;
+	// The topmost window has to stay inside the depth range of the
+	// projection
+	if (2 * n + 2 >= 1000)
+		return -1;
+
+	auto wins = ccalloc(nsolid + 1, win *);
+	n = 0;
+	for (win *w = t; n < nsolid; w = w->prev_trans)
+		wins[n++] = w;
+
+	// Clearing is limited by the scissor box
+	glx_set_clip(ps, NULL);
+	glDepthMask(GL_TRUE);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	ps->psglx->z_fixed = true;
+
+	region_t reg_tmp;
+	pixman_region32_init(&reg_tmp);
+	for (int i = nsolid - 1; i >= 0; --i) {
+		win *w = wins[i];
+		if (!win_is_solid(ps, w))
+			continue;
+
+		region_t bshape = win_get_bounding_shape_global_by_val(w);
+		pixman_region32_intersect(&reg_tmp, &bshape, region);
+		pixman_region32_fini(&bshape);
+		if (pixman_region32_not_empty(&reg_tmp)) {
+			set_tgt_clip(ps, &reg_tmp);
+			ps->psglx->z = 2 * i + 2;
+			paint_one(ps, w, &reg_tmp);
+		}
+	}
+	pixman_region32_fini(&reg_tmp);
+	free(wins);
+
+	// The rest of the frame is only tested against solid windows
+	glDepthMask(GL_FALSE);
+	ps->psglx->z = 0;
+
+	return nsolid;
+}
+#endif
+
 /// paint all windows
 /// region = ??
 /// region_real = the damage region
@@ -859,7 +1645,17 @@ void paint_all(session_t *ps, region_t *region, const region_t *region_real, win
 
 	region_t reg_tmp, *reg_paint;
 	pixman_region32_init(&reg_tmp);
-	if (t) {
+
+	// With the depth test, what solid windows cover is rejected by the GPU
+	// instead of being cut out of the regions painted
+#ifdef CONFIG_OPENGL
+	const int nsolid = paint_solid_front_to_back(ps, region, t);
+#else
+	const int nsolid = -1;
+#endif
+	const bool depth = nsolid >= 0;
+
+	if (t && !depth) {
 		// Calculate the region upon which the root window is to be painted
 		// based on the ignore region of the lowest window, if available
 		pixman_region32_subtract(&reg_tmp, region, t->reg_ignore);
@@ -876,18 +1672,22 @@ void paint_all(session_t *ps, region_t *region, const region_t *region_real, win
 	// on top of that window. This is used to reduce the number of pixels painted.
 	//
 	// Whether this is beneficial is to be determined XXX
-	for (win *w = t; w; w = w->prev_trans) {
+	int i = 0;
+	for (win *w = t; w; w = w->prev_trans, ++i) {
 		region_t bshape = win_get_bounding_shape_global_by_val(w);
 		// Painting shadow
-		if (w->shadow) {
+		// Nothing to paint before the shadow tables are computed, unless
+		// shadows don't need them
+		if (w->shadow && (ps->shadow_top || shadow_analytic(ps))) {
 			// Lazy shadow building
-			if (!w->shadow_paint.pixmap)
-				if (!win_build_shadow(ps, w, 1))
-					printf_errf("(): build shadow failed");
+			win_update_shadow(ps, w);
 
 			// Shadow doesn't need to be painted underneath the body of
 			// the window Because no one can see it
-			pixman_region32_subtract(&reg_tmp, region, w->reg_ignore);
+			if (depth)
+				copy_region(&reg_tmp, region);
+			else
+				pixman_region32_subtract(&reg_tmp, region, w->reg_ignore);
 
 			// Mask out the region we don't want shadow on
 			if (pixman_region32_not_empty(&ps->shadow_exclude_reg))
@@ -923,6 +1723,10 @@ void paint_all(session_t *ps, region_t *region, const region_t *region_real, win
 			// Detect if the region is empty before painting
 			if (pixman_region32_not_empty(&reg_tmp)) {
 				set_tgt_clip(ps, &reg_tmp);
+#ifdef CONFIG_OPENGL
+				if (depth)
+					ps->psglx->z = 2 * i + 1;
+#endif
 				win_paint_shadow(ps, w, &reg_tmp);
 			}
 		}
@@ -930,25 +1734,45 @@ void paint_all(session_t *ps, region_t *region, const region_t *region_real, win
 		// Calculate the region based on the reg_ignore of the next (higher)
 		// window and the bounding region
 		// XXX XXX
-		pixman_region32_subtract(&reg_tmp, region, w->reg_ignore);
+		// Solid windows painted front to back only cast shadows here
+		if (depth && i < nsolid && win_is_solid(ps, w))
+			pixman_region32_clear(&reg_tmp);
+		else if (depth)
+			copy_region(&reg_tmp, region);
+		else
+			pixman_region32_subtract(&reg_tmp, region, w->reg_ignore);
 		pixman_region32_intersect(&reg_tmp, &reg_tmp, &bshape);
 		pixman_region32_fini(&bshape);
 
 		if (pixman_region32_not_empty(&reg_tmp)) {
+			win_flush_shadows(ps);
 			set_tgt_clip(ps, &reg_tmp);
+#ifdef CONFIG_OPENGL
+			if (depth)
+				ps->psglx->z = 2 * i + 2;
+#endif
 			// Blur window background
-			if (w->blur_background &&
-			    (!win_is_solid(ps, w) ||
-			     (ps->o.blur_background_frame && w->frame_opacity != 1)))
+			if (win_blurs_background(ps, w))
 				win_blur_background(ps, w, ps->tgt_buffer.pict, &reg_tmp);
 
 			// Painting the window
 			paint_one(ps, w, &reg_tmp);
 		}
 	}
+	win_flush_shadows(ps);
+
+#ifdef CONFIG_OPENGL
+	if (depth) {
+		glDisable(GL_DEPTH_TEST);
+		ps->psglx->z_fixed = false;
+	}
+#endif
 
 	// Free up all temporary regions
 	pixman_region32_fini(&reg_tmp);
+	if (ps->o.blur_background)
+		for (win *w = ps->list; w; w = w->next)
+			pixman_region32_clear(&w->damage_content);
 
 	// Do this as early as possible
 	set_tgt_clip(ps, &ps->screen_reg);
@@ -1166,30 +1990,34 @@ static bool init_alpha_picts(session_t *ps) {
 	return true;
 }
 
+/// Shadow tables being computed on a worker thread
+struct presum_job {
+	session_t *ps;
+	const conv *map;
+	unsigned char *shadow_corner;
+	unsigned char *shadow_top;
+};
+
 /// precompute shadow corners and sides to save time for large windows
-static void presum_gaussian(session_t *ps, conv *map) {
-	ps->cgsize = map->size;
+static void presum_gaussian(void *data) {
+	struct presum_job *job = data;
+	const conv *map = job->map;
+	const int cgsize = map->size;
 
 	const int center = map->size / 2;
-	const int r = ps->cgsize + 1;        // radius of the kernel
-	const int width = ps->cgsize * 2, height = ps->cgsize * 2;
-
-
-	if (ps->shadow_corner)
-		free(ps->shadow_corner);
-	if (ps->shadow_top)
-		free(ps->shadow_top);
+	const int r = cgsize + 1;        // radius of the kernel
+	const int width = cgsize * 2, height = cgsize * 2;
 
 	// clang-format off
-	ps->shadow_corner = cvalloc(r*r*26);
-	ps->shadow_top = cvalloc(r*26);
+	unsigned char *shadow_corner = job->shadow_corner = cvalloc(r*r*26);
+	unsigned char *shadow_top = job->shadow_top = cvalloc(r*26);
 
 	for (int x = 0; x < r; x++) {
 		double sum = sum_kernel(map, x-center, center, width, height);
-		int tmp = ps->shadow_top[25*r+x] = (unsigned char)(sum*255.0);
+		int tmp = shadow_top[25*r+x] = (unsigned char)(sum*255.0);
 
 		for (int opacity = 0; opacity < 25; opacity++) {
-			ps->shadow_top[opacity*r+x] = tmp*opacity/25;
+			shadow_top[opacity*r+x] = tmp*opacity/25;
 		}
 	}
 
@@ -1197,20 +2025,38 @@ static void presum_gaussian(session_t *ps, conv *map) {
 		for (int y = 0; y <= x; y++) {
 			double sum =
 			    sum_kernel(map, x-center, y-center, width, height);
-			ps->shadow_corner[25*r*r+y*r+x] = (unsigned char)(sum*255.0);
-			ps->shadow_corner[25*r*r+x*r+y] = ps->shadow_corner[25*r*r+y*r+x];
+			shadow_corner[25*r*r+y*r+x] = (unsigned char)(sum*255.0);
+			shadow_corner[25*r*r+x*r+y] = shadow_corner[25*r*r+y*r+x];
 
 			for (int opacity = 0; opacity < 25; opacity++) {
-				ps->shadow_corner[opacity*r*r+y*r+x] =
-				ps->shadow_corner[opacity*r*r+x*r+y] =
-				    ps->shadow_corner[25*r*r+y*r+x]*opacity/25;
+				shadow_corner[opacity*r*r+y*r+x] =
+				shadow_corner[opacity*r*r+x*r+y] =
+				    shadow_corner[25*r*r+y*r+x]*opacity/25;
 			}
 		}
 	}
 	// clang-format on
 }
 
+/// Install the shadow tables computed by presum_gaussian()
+static void presum_gaussian_done(void *data) {
+	struct presum_job *job = data;
+	session_t *ps = job->ps;
+
+	free(ps->shadow_corner);
+	free(ps->shadow_top);
+	ps->shadow_corner = job->shadow_corner;
+	ps->shadow_top = job->shadow_top;
+	free(job);
+
+	queue_redraw(ps);
+}
+
 bool init_render(session_t *ps) {
+	idmap_init(&ps->shadow_cache.map);
+	ps->workers = worker_pool_new(ps->loop);
+	ps->shm = shm_pool_new(ps->c);
+
 	// Initialize OpenGL as early as possible
 	if (bkend_use_glx(ps)) {
 #ifdef CONFIG_OPENGL
@@ -1244,6 +2090,35 @@ bool init_render(session_t *ps) {
 		return false;
 	}
 
+	// Analytic shadow program, shadow images are used if it can't be built
+	if (ps->o.glx_analytic_shadow) {
+#ifdef CONFIG_OPENGL
+		if (BKEND_GLX != ps->o.backend || !glx_init_shadow(ps)) {
+			printf_errf("(): Can't draw shadows analytically, falling "
+			            "back to shadow images.");
+			ps->o.glx_analytic_shadow = false;
+		}
+#else
+		ps->o.glx_analytic_shadow = false;
+#endif
+	}
+
+	// Front to back painting needs a depth buffer
+	if (ps->o.glx_front_to_back) {
+#ifdef CONFIG_OPENGL
+		GLint depth_bits = 0;
+		if (BKEND_GLX == ps->o.backend)
+			glGetIntegerv(GL_DEPTH_BITS, &depth_bits);
+		if (!depth_bits) {
+			printf_errf("(): --glx-front-to-back needs the glx backend "
+			            "and a depth buffer, painting back to front.");
+			ps->o.glx_front_to_back = false;
+		}
+#else
+		ps->o.glx_front_to_back = false;
+#endif
+	}
+
 	// Blur filter
 	if (ps->o.blur_background || ps->o.blur_background_frame) {
 		bool ret;
@@ -1260,7 +2135,12 @@ bool init_render(session_t *ps) {
 	}
 
 	ps->gaussian_map = gaussian_kernel(ps->o.shadow_radius);
-	presum_gaussian(ps, ps->gaussian_map);
+	ps->cgsize = ps->gaussian_map->size;
+	// Shadows are not painted until the tables are ready
+	auto job = cmalloc(struct presum_job);
+	job->ps = ps;
+	job->map = ps->gaussian_map;
+	worker_submit(ps->workers, presum_gaussian, presum_gaussian_done, job);
 
 	ps->black_picture = solid_picture(ps, true, 1, 0, 0, 0);
 	ps->white_picture = solid_picture(ps, true, 1, 1, 1, 1);
@@ -1270,18 +2150,7 @@ bool init_render(session_t *ps) {
 		return false;
 	}
 
-	// Generates another Picture for shadows if the color is modified by
-	// user
-	if (!ps->o.shadow_red && !ps->o.shadow_green && !ps->o.shadow_blue) {
-		ps->cshadow_picture = ps->black_picture;
-	} else {
-		ps->cshadow_picture = solid_picture(
-		    ps, true, 1, ps->o.shadow_red, ps->o.shadow_green, ps->o.shadow_blue);
-		if (ps->cshadow_picture == XCB_NONE) {
-			printf_errf("(): Failed to create shadow picture.");
-			return false;
-		}
-	}
+	ps->cshadow_picts = ccalloc(MAX_ALPHA + 1, xcb_render_picture_t);
 	return true;
 }
 
@@ -1304,17 +2173,24 @@ void free_root_tile(session_t *ps) {
 }
 
 void deinit_render(session_t *ps) {
+	// Finish the jobs in flight first, they use the resources freed below
+	worker_pool_free(ps->workers);
+	ps->workers = NULL;
+	shm_pool_free(ps->shm);
+	ps->shm = NULL;
+
 	// Free alpha_picts
 	for (int i = 0; i <= MAX_ALPHA; ++i)
 		free_picture(ps->c, &ps->alpha_picts[i]);
 	free(ps->alpha_picts);
 	ps->alpha_picts = NULL;
 
-	// Free cshadow_picture and black_picture
-	if (ps->cshadow_picture == ps->black_picture)
-		ps->cshadow_picture = XCB_NONE;
-	else
-		free_picture(ps->c, &ps->cshadow_picture);
+	// Free cshadow_picts
+	if (ps->cshadow_picts)
+		for (int i = 0; i <= MAX_ALPHA; ++i)
+			free_picture(ps->c, &ps->cshadow_picts[i]);
+	free(ps->cshadow_picts);
+	ps->cshadow_picts = NULL;
 
 	free_picture(ps->c, &ps->black_picture);
 	free_picture(ps->c, &ps->white_picture);
@@ -1322,6 +2198,18 @@ void deinit_render(session_t *ps) {
 	free(ps->shadow_top);
 	free(ps->gaussian_map);
 
+	// Free cached shadows, no window should be using them by now
+	shadow_cache_t *sc = &ps->shadow_cache;
+	while (sc->lru_tail) {
+		shadow_t *s = sc->lru_tail;
+		shadow_lru_remove(sc, s);
+		shadow_destroy(ps, s);
+	}
+	assert(!sc->map.count);
+	idmap_deinit(&sc->map);
+	for (int i = 0; i < 4; i++)
+		free_paint(ps, &sc->quadrants[i]);
+
 	// Free other X resources
 	free_root_tile(ps);
 
@@ -4,6 +4,7 @@
 
 #include <xcb/render.h>
 #include "region.h"
+#include "idmap.h"
 
 typedef struct _glx_texture glx_texture_t;
 typedef struct glx_prog_main glx_prog_main_t;
@@ -16,6 +17,50 @@ typedef struct paint {
   glx_texture_t *ptex;
 } paint_t;
 
+/// A shadow, shared by all windows of the same size.
+typedef struct shadow {
+  paint_t paint;
+  /// Size of the window the shadow is for.
+  int width, height;
+  /// Number of windows using the shadow.
+  int refcount;
+  /// Video memory used by the shadow, in bytes.
+  size_t size;
+  /// Whether the shadow is in the cache.
+  bool cached;
+  /// Whether the shadow image has been built and uploaded. Shadows are built
+  /// on the worker threads.
+  bool ready;
+  /// Neighbours in the LRU list of unused shadows.
+  struct shadow *lru_prev, *lru_next;
+} shadow_t;
+
+/// Cache of shadows, by window size.
+typedef struct shadow_cache {
+  idmap_t map;
+  /// Shadows no window uses, most recently used first. They are kept until
+  /// they no longer fit in the memory budget.
+  shadow_t *lru_head, *lru_tail;
+  /// Memory used by shadows in the LRU list, in bytes.
+  size_t unused_size;
+  /// Number of lookups that found a shadow.
+  unsigned long hits;
+  /// Number of lookups that had to build a shadow.
+  unsigned long misses;
+  /// The four quadrants of the shadow of a window exactly as large as the
+  /// shadow radius, plus the row and column of edge pixels between them.
+  /// Shadows of windows at least that large are drawn from them with pad
+  /// repeat, so they are never rebuilt on resize. Built on first use.
+  paint_t quadrants[4];
+} shadow_cache_t;
+
+/// Fraction of shadow lookups served from the cache.
+static inline double
+shadow_cache_hit_rate(const shadow_cache_t *sc) {
+  unsigned long total = sc->hits + sc->misses;
+  return total ? (double) sc->hits / total : 0.0;
+}
+
 void
 render(session_t *ps, int x, int y, int dx, int dy, int wid, int hei,
     double opacity, bool argb, bool neg,
@@ -24,12 +69,16 @@ render(session_t *ps, int x, int y, int dx, int dy, int wid, int hei,
 void
 paint_one(session_t *ps, win *w, const region_t *reg_paint);
 
+void
+paint_blur_invalidate(session_t *ps, region_t *damage, win * const t);
+
 void
 paint_all(session_t *ps, region_t *region, const region_t *region_real, win * const t);
 
 void free_picture(xcb_connection_t *c, xcb_render_picture_t *p);
 
 void free_paint(session_t *ps, paint_t *ppaint);
+void shadow_release(session_t *ps, shadow_t **pshadow);
 void free_root_tile(session_t *ps);
 
 bool init_render(session_t *ps);
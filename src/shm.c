@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+
+#include "utils.h"
+#include "log.h"
+#include "shm.h"
+
+/// Images smaller than this are sent through the connection, a segment costs
+/// more than copying them
+#define SHM_MIN_SIZE (16 * 1024)
+/// Segments are allocated in multiples of this
+#define SHM_GRANULARITY (64 * 1024)
+/// Number of unused segments kept around
+#define SHM_MAX_FREE 4
+
+struct shm_seg {
+  xcb_shm_seg_t seg;
+  void *addr;
+  size_t size;
+  /// The last request reading from the segment, if it might not have been
+  /// processed yet
+  xcb_void_cookie_t cookie;
+  bool in_flight;
+  struct shm_seg *next;
+};
+
+struct shm_pool {
+  xcb_connection_t *c;
+  /// Segments not in use
+  struct shm_seg *free;
+  int nfree;
+  /// Set when attaching a segment fails, e.g. with a remote X server
+  bool broken;
+};
+
+struct shm_pool *shm_pool_new(xcb_connection_t *c) {
+  const xcb_query_extension_reply_t *ext = xcb_get_extension_data(c, &xcb_shm_id);
+  if (!ext || !ext->present)
+    return NULL;
+
+  auto pool = ccalloc(1, struct shm_pool);
+  pool->c = c;
+  return pool;
+}
+
+/// Wait for the X server to be done with a segment
+static inline void
+shm_seg_wait(struct shm_pool *pool, struct shm_seg *seg) {
+  if (!seg->in_flight)
+    return;
+  free(xcb_request_check(pool->c, seg->cookie));
+  seg->in_flight = false;
+}
+
+static void
+shm_seg_destroy(struct shm_pool *pool, struct shm_seg *seg) {
+  // The server keeps its own mapping until it processes the detach, after the
+  // requests reading from the segment
+  if (seg->in_flight)
+    xcb_discard_reply(pool->c, seg->cookie.sequence);
+  xcb_shm_detach(pool->c, seg->seg);
+  shmdt(seg->addr);
+  free(seg);
+}
+
+void shm_pool_free(struct shm_pool *pool) {
+  if (!pool)
+    return;
+  while (pool->free) {
+    struct shm_seg *next = pool->free->next;
+    shm_seg_destroy(pool, pool->free);
+    pool->free = next;
+  }
+  free(pool);
+}
+
+static struct shm_seg *
+shm_seg_new(struct shm_pool *pool, size_t size) {
+  size = (size + SHM_GRANULARITY - 1) / SHM_GRANULARITY * SHM_GRANULARITY;
+
+  int shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (shmid < 0) {
+    printf_errf("(): Failed to create a shared memory segment of %zu bytes",
+        size);
+    return NULL;
+  }
+
+  void *addr = shmat(shmid, NULL, 0);
+  if (addr == (void *) -1) {
+    printf_errf("(): Failed to map a shared memory segment");
+    shmctl(shmid, IPC_RMID, NULL);
+    return NULL;
+  }
+
+  xcb_shm_seg_t seg = xcb_generate_id(pool->c);
+  xcb_generic_error_t *e = xcb_request_check(pool->c,
+      xcb_shm_attach_checked(pool->c, seg, shmid, true));
+  // The segment goes away once both sides have detached it
+  shmctl(shmid, IPC_RMID, NULL);
+  if (e) {
+    printf_errf("(): X server failed to attach a shared memory segment, "
+        "falling back to uploading through the connection");
+    free(e);
+    shmdt(addr);
+    pool->broken = true;
+    return NULL;
+  }
+
+  auto s = ccalloc(1, struct shm_seg);
+  s->seg = seg;
+  s->addr = addr;
+  s->size = size;
+  return s;
+}
+
+struct shm_seg *shm_seg_get(struct shm_pool *pool, size_t size) {
+  if (!pool || pool->broken || size < SHM_MIN_SIZE)
+    return NULL;
+
+  // Smallest free segment large enough
+  struct shm_seg **best = NULL;
+  for (struct shm_seg **p = &pool->free; *p; p = &(*p)->next)
+    if ((*p)->size >= size && (!best || (*p)->size < (*best)->size))
+      best = p;
+
+  if (!best)
+    return shm_seg_new(pool, size);
+
+  struct shm_seg *seg = *best;
+  *best = seg->next;
+  pool->nfree--;
+  seg->next = NULL;
+  shm_seg_wait(pool, seg);
+  return seg;
+}
+
+void *shm_seg_data(const struct shm_seg *seg) {
+  return seg->addr;
+}
+
+void shm_seg_release(struct shm_pool *pool, struct shm_seg *seg) {
+  if (pool->nfree >= SHM_MAX_FREE) {
+    // Drop the smallest segment, larger ones can serve more images
+    struct shm_seg **smallest = &pool->free;
+    for (struct shm_seg **p = &pool->free; *p; p = &(*p)->next)
+      if ((*p)->size < (*smallest)->size)
+        smallest = p;
+    if ((*smallest)->size < seg->size) {
+      struct shm_seg *victim = *smallest;
+      *smallest = victim->next;
+      pool->nfree--;
+      shm_seg_destroy(pool, victim);
+    } else {
+      shm_seg_destroy(pool, seg);
+      return;
+    }
+  }
+
+  seg->next = pool->free;
+  pool->free = seg;
+  pool->nfree++;
+}
+
+void shm_seg_put(struct shm_pool *pool, struct shm_seg *seg,
+    xcb_drawable_t drawable, xcb_gcontext_t gc, const xcb_image_t *image,
+    int16_t dst_x, int16_t dst_y) {
+  seg->cookie = xcb_shm_put_image_checked(pool->c, drawable, gc, image->width,
+      image->height, 0, 0, image->width, image->height, dst_x, dst_y,
+      image->depth, image->format, false, seg->seg, 0);
+  seg->in_flight = true;
+  shm_seg_release(pool, seg);
+}
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <xcb/xcb.h>
+#include <xcb/xcb_image.h>
+
+/// A pool of MIT-SHM segments, for uploading images without copying them
+/// through the X connection.
+///
+/// A segment handed to the X server is not reused before the server is done
+/// reading it, and segments are recycled between uploads.
+struct shm_pool;
+struct shm_seg;
+
+/// Create a pool of shared memory segments.
+///
+/// @return the pool, NULL if the X server doesn't support MIT-SHM
+struct shm_pool *shm_pool_new(xcb_connection_t *c);
+void shm_pool_free(struct shm_pool *pool);
+
+/// Get a segment of at least size bytes.
+///
+/// @return the segment, NULL if shared memory can't be used, or isn't worth
+///         it for an image this small
+struct shm_seg *shm_seg_get(struct shm_pool *pool, size_t size);
+
+/// Memory of a segment, mapped in our address space.
+void *shm_seg_data(const struct shm_seg *seg);
+
+/// Upload an image whose data lives in a segment, and give the segment back
+/// to the pool.
+void shm_seg_put(struct shm_pool *pool, struct shm_seg *seg,
+    xcb_drawable_t drawable, xcb_gcontext_t gc, const xcb_image_t *image,
+    int16_t dst_x, int16_t dst_y);
+
+/// Give a segment back to the pool without using it.
+void shm_seg_release(struct shm_pool *pool, struct shm_seg *seg);
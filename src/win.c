@@ -163,31 +163,135 @@ void win_rounded_corners(session_t *ps, win *w) {
     }
 }
 
-int win_get_name(session_t *ps, win *w) {
-  XTextProperty text_prop = { NULL, None, 0, 0 };
+/**
+ * Send the requests needed to refresh a property of a window.
+ *
+ * Requests that aren't needed are left with a sequence number of 0.
+ *
+ * @param prop the WIN_PROP_* to refresh
+ */
+static void
+win_prop_request(session_t *ps, const win *w, uint32_t prop,
+    xcb_get_property_cookie_t cookies[2]) {
+  const Window client = w->client_win;
+  cookies[0].sequence = cookies[1].sequence = 0;
+
+  switch (prop) {
+    case WIN_PROP_WINTYPE:
+      if (!client)
+        break;
+      cookies[0] = xcb_get_property(ps->c, 0, client, ps->atom_win_type,
+          XCB_ATOM_ATOM, 0, 32);
+      // Only whether it exists matters
+      cookies[1] = xcb_get_property(ps->c, 0, client, ps->atom_transient,
+          XCB_ATOM_ANY, 0, 0);
+      break;
+    case WIN_PROP_FRAME_EXTENTS:
+      if (client)
+        cookies[0] = xcb_get_property(ps->c, 0, client,
+            ps->atom_frame_extents, XCB_ATOM_CARDINAL, 0, 4);
+      break;
+    case WIN_PROP_LEADER:
+      if (client && ps->o.detect_transient)
+        cookies[0] = xcb_get_property(ps->c, 0, client, ps->atom_transient,
+            XCB_ATOM_WINDOW, 0, 1);
+      if (client && ps->o.detect_client_leader)
+        cookies[1] = xcb_get_property(ps->c, 0, client,
+            ps->atom_client_leader, XCB_ATOM_WINDOW, 0, 1);
+      break;
+    case WIN_PROP_NAME:
+      if (!client)
+        break;
+      cookies[0] = x_request_text_prop(ps->c, client, ps->atom_name_ewmh);
+      cookies[1] = x_request_text_prop(ps->c, client, ps->atom_name);
+      break;
+    case WIN_PROP_CLASS:
+      if (client)
+        cookies[0] = x_request_text_prop(ps->c, client, ps->atom_class);
+      break;
+    case WIN_PROP_ROLE:
+      if (client)
+        cookies[0] = x_request_text_prop(ps->c, client, ps->atom_role);
+      break;
+    case WIN_PROP_OPACITY:
+      // The opacity of the frame takes precedence, the one of the client is
+      // only used if the frame doesn't have one
+      cookies[0] = xcb_get_property(ps->c, 0, w->id, ps->atom_opacity,
+          XCB_ATOM_CARDINAL, 0, 1);
+      if (client && !(ps->o.detect_client_opacity && w->id == client))
+        cookies[1] = xcb_get_property(ps->c, 0, client, ps->atom_opacity,
+            XCB_ATOM_CARDINAL, 0, 1);
+      break;
+    case WIN_PROP_SHADOW:
+      // The property must be set on the outermost window, usually the WM
+      // frame.
+      cookies[0] = xcb_get_property(ps->c, 0, w->id, ps->atom_compton_shadow,
+          XCB_ATOM_CARDINAL, 0, 1);
+      break;
+    default:
+      assert(0);
+  }
+}
+
+/**
+ * Wait for the replies of requests sent by win_prop_request(). A reply is
+ * NULL if its request failed, or wasn't sent.
+ */
+static inline void
+win_prop_collect(session_t *ps, const xcb_get_property_cookie_t cookies[2],
+    xcb_get_property_reply_t *r[2]) {
+  for (int i = 0; i < 2; i++)
+    r[i] = cookies[i].sequence ?
+      xcb_get_property_reply(ps->c, cookies[i], NULL): NULL;
+}
+
+static inline void
+win_prop_free(xcb_get_property_reply_t *r[2]) {
+  free(r[0]);
+  free(r[1]);
+  r[0] = r[1] = NULL;
+}
+
+/**
+ * Take a reply out of the ones collected by win_prop_collect(), as a
+ * <code>winprop_t</code>.
+ */
+static inline winprop_t
+win_prop_take(xcb_get_property_reply_t **pr, xcb_atom_t rtype, int rformat) {
+  winprop_t prop = x_prop_from_reply(*pr, rtype, rformat);
+  *pr = NULL;
+  return prop;
+}
+
+/**
+ * Fetch what's needed to refresh a property of a window, and wait for it.
+ */
+static inline void
+win_prop_fetch(session_t *ps, const win *w, uint32_t prop,
+    xcb_get_property_reply_t *r[2]) {
+  xcb_get_property_cookie_t cookies[2];
+  win_prop_request(ps, w, prop, cookies);
+  win_prop_collect(ps, cookies, r);
+}
+
+/**
+ * Update the name of a window from replies of _NET_WM_NAME and WM_NAME
+ * requests.
+ *
+ * @return -1 on failure, 1 if the name changed, 0 otherwise
+ */
+static int
+win_set_name(session_t *ps, win *w, xcb_get_property_reply_t *r[2]) {
   char **strlst = NULL;
   int nstr = 0;
 
-  if (!w->client_win)
-    return 0;
-
-  if (!(wid_get_text_prop(ps, w->client_win, ps->atom_name_ewmh, &strlst, &nstr))) {
+  if (!x_text_prop_from_reply(ps, r[0], &strlst, &nstr)) {
 #ifdef DEBUG_WINDATA
-    printf_dbgf("(%#010lx): _NET_WM_NAME unset, falling back to WM_NAME.\n", wid);
+    printf_dbgf("(%#010lx): _NET_WM_NAME unset, falling back to WM_NAME.\n", w->id);
 #endif
 
-    if (!(XGetWMName(ps->dpy, w->client_win, &text_prop) && text_prop.value)) {
-      return -1;
-    }
-    if (Success !=
-        XmbTextPropertyToTextList(ps->dpy, &text_prop, &strlst, &nstr)
-        || !nstr || !strlst) {
-      if (strlst)
-        XFreeStringList(strlst);
-      cxfree(text_prop.value);
+    if (!x_text_prop_from_reply(ps, r[1], &strlst, &nstr))
       return -1;
-    }
-    cxfree(text_prop.value);
   }
 
   int ret = 0;
@@ -206,11 +310,17 @@ int win_get_name(session_t *ps, win *w) {
   return ret;
 }
 
-int win_get_role(session_t *ps, win *w) {
+/**
+ * Update the role of a window from the reply of a WM_WINDOW_ROLE request.
+ *
+ * @return -1 on failure, 1 if the role changed, 0 otherwise
+ */
+static int
+win_set_role(session_t *ps, win *w, xcb_get_property_reply_t *r[2]) {
   char **strlst = NULL;
   int nstr = 0;
 
-  if (!wid_get_text_prop(ps, w->client_win, ps->atom_role, &strlst, &nstr))
+  if (!x_text_prop_from_reply(ps, r[0], &strlst, &nstr))
     return -1;
 
   int ret = 0;
@@ -229,6 +339,25 @@ int win_get_role(session_t *ps, win *w) {
   return ret;
 }
 
+int win_get_name(session_t *ps, win *w) {
+  if (!w->client_win)
+    return 0;
+
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_NAME, r);
+  int ret = win_set_name(ps, w, r);
+  win_prop_free(r);
+  return ret;
+}
+
+int win_get_role(session_t *ps, win *w) {
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_ROLE, r);
+  int ret = win_set_role(ps, w, r);
+  win_prop_free(r);
+  return ret;
+}
+
 /**
  * Check if a window is bounding-shaped.
  */
@@ -248,39 +377,35 @@ static inline bool win_bounding_shaped(const session_t *ps, Window wid) {
   return false;
 }
 
-wintype_t wid_get_prop_wintype(session_t *ps, Window wid) {
-  set_ignore_next(ps);
-  winprop_t prop = wid_get_prop(ps, wid, ps->atom_win_type, 32L, XCB_ATOM_ATOM, 32);
-
+static wintype_t
+wintype_from_prop(session_t *ps, winprop_t prop) {
   for (unsigned i = 0; i < prop.nitems; ++i) {
     for (wintype_t j = 1; j < NUM_WINTYPES; ++j) {
-      if (ps->atoms_wintypes[j] == (xcb_atom_t)prop.p32[i]) {
-        free_winprop(&prop);
+      if (ps->atoms_wintypes[j] == (xcb_atom_t)prop.p32[i])
         return j;
-      }
     }
   }
 
-  free_winprop(&prop);
-
   return WINTYPE_UNKNOWN;
 }
 
-bool wid_get_opacity_prop(session_t *ps, Window wid, opacity_t def,
-                          opacity_t *out) {
-  bool ret = false;
-  *out = def;
-
-  winprop_t prop = wid_get_prop(ps, wid, ps->atom_opacity, 1L, XCB_ATOM_CARDINAL, 32);
-
-  if (prop.nitems) {
-    *out = *prop.c32;
-    ret = true;
+/**
+ * Update the opacity property of a window from replies of requests for the
+ * frame and the client window.
+ */
+static void
+win_set_opacity_prop(win *w, xcb_get_property_reply_t *r[2]) {
+  w->has_opacity_prop = false;
+  w->opacity_prop = OPAQUE;
+
+  for (int i = 0; i < 2 && !w->has_opacity_prop; i++) {
+    winprop_t prop = win_prop_take(&r[i], XCB_ATOM_CARDINAL, 32);
+    if (prop.nitems) {
+      w->opacity_prop = *prop.c32;
+      w->has_opacity_prop = true;
+    }
+    free_winprop(&prop);
   }
-
-  free_winprop(&prop);
-
-  return ret;
 }
 
 // XXX should distinguish between frame has alpha and window body has alpha
@@ -385,20 +510,18 @@ void win_determine_fade(session_t *ps, win *w) {
   // Ignore other possible causes of fading state changes after window
   // gets unmapped
   else if (w->a.map_state != XCB_MAP_STATE_VIEWABLE) {
-  } else if (c2_match(ps, w, ps->o.fade_blacklist, &w->cache_fblst, NULL))
+  } else if (c2_match_cached(ps, w, ps->o.fade_blacklist, &w->cache_fblst, NULL))
     w->fade = false;
   else
     w->fade = ps->o.wintype_option[w->window_type].fade;
 }
 
 /**
- * Reread _COMPTON_SHADOW property from a window.
- *
- * The property must be set on the outermost window, usually the WM frame.
+ * Update _COMPTON_SHADOW property of a window from the reply of a request.
  */
-void win_update_prop_shadow_raw(session_t *ps, win *w) {
-  winprop_t prop =
-      wid_get_prop(ps, w->id, ps->atom_compton_shadow, 1, XCB_ATOM_CARDINAL, 32);
+static void
+win_set_prop_shadow(win *w, xcb_get_property_reply_t *r[2]) {
+  winprop_t prop = win_prop_take(&r[0], XCB_ATOM_CARDINAL, 32);
 
   if (!prop.nitems) {
     w->prop_shadow = -1;
@@ -409,6 +532,18 @@ void win_update_prop_shadow_raw(session_t *ps, win *w) {
   free_winprop(&prop);
 }
 
+/**
+ * Reread _COMPTON_SHADOW property from a window.
+ *
+ * The property must be set on the outermost window, usually the WM frame.
+ */
+void win_update_prop_shadow_raw(session_t *ps, win *w) {
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_SHADOW, r);
+  win_set_prop_shadow(w, r);
+  win_prop_free(r);
+}
+
 /**
  * Reread _COMPTON_SHADOW property from a window and update related
  * things.
@@ -459,7 +594,8 @@ void win_determine_shadow(session_t *ps, win *w) {
     shadow_new = w->shadow_force;
   else if (w->a.map_state == XCB_MAP_STATE_VIEWABLE)
     shadow_new = (ps->o.wintype_option[w->window_type].shadow &&
-                  !c2_match(ps, w, ps->o.shadow_blacklist, &w->cache_sblst, NULL) &&
+                  !c2_match_cached(ps, w, ps->o.shadow_blacklist,
+                                   &w->cache_sblst, NULL) &&
                   !(ps->o.shadow_ignore_shaped && w->bounding_shaped &&
                     !w->rounded_corners) &&
                   !(ps->o.respect_prop_shadow && 0 == w->prop_shadow));
@@ -486,7 +622,7 @@ void win_determine_invert_color(session_t *ps, win *w) {
     invert_color_new = w->invert_color_force;
   else if (w->a.map_state == XCB_MAP_STATE_VIEWABLE)
     invert_color_new =
-        c2_match(ps, w, ps->o.invert_color_list, &w->cache_ivclst, NULL);
+        c2_match_cached(ps, w, ps->o.invert_color_list, &w->cache_ivclst, NULL);
 
   win_set_invert_color(ps, w, invert_color_new);
 }
@@ -512,7 +648,8 @@ void win_determine_blur_background(session_t *ps, win *w) {
 
   bool blur_background_new =
       ps->o.blur_background &&
-      !c2_match(ps, w, ps->o.blur_background_blacklist, &w->cache_bbblst, NULL);
+      !c2_match_cached(ps, w, ps->o.blur_background_blacklist,
+                       &w->cache_bbblst, NULL);
 
   win_set_blur_background(ps, w, blur_background_new);
 }
@@ -527,7 +664,7 @@ void win_update_opacity_rule(session_t *ps, win *w) {
   opacity_t opacity = OPAQUE;
   bool is_set = false;
   void *val = NULL;
-  if (c2_match(ps, w, ps->o.opacity_rules, &w->cache_oparule, &val)) {
+  if (c2_match_cached(ps, w, ps->o.opacity_rules, &w->cache_oparule, &val)) {
     opacity = ((double)(long)val) / 100.0 * OPAQUE;
     is_set = true;
   }
@@ -543,10 +680,25 @@ void win_update_opacity_rule(session_t *ps, win *w) {
     wid_set_opacity_prop(ps, w->id, opacity);
 }
 
+/**
+ * Mark window data as changed, so the condition lists depending on it are
+ * matched again next time.
+ */
+static void win_c2_dirty(win *w, uint32_t changed) {
+  c2_result_t * const results[] = {
+    &w->cache_sblst, &w->cache_fblst, &w->cache_fcblst, &w->cache_ivclst,
+    &w->cache_bbblst, &w->cache_oparule, &w->cache_pblst, &w->cache_uipblst,
+  };
+  for (size_t i = 0; i < ARR_SIZE(results); i++)
+    results[i]->dirty |= changed;
+  c2_ms_result_invalidate(w, changed);
+}
+
 /**
  * Function to be called on window type changes.
  */
 void win_on_wtype_change(session_t *ps, win *w) {
+  win_c2_dirty(w, C2_DEP_WINTYPE);
   win_determine_shadow(ps, w);
   win_determine_fade(ps, w);
   win_update_focused(ps, w);
@@ -558,8 +710,11 @@ void win_on_wtype_change(session_t *ps, win *w) {
 
 /**
  * Function to be called on window data changes.
+ *
+ * @param changed mask of C2_DEP_* of the window data that changed
  */
-void win_on_factor_change(session_t *ps, win *w) {
+void win_on_factor_change(session_t *ps, win *w, uint32_t changed) {
+  win_c2_dirty(w, changed);
   if (ps->o.shadow_blacklist)
     win_determine_shadow(ps, w);
   if (ps->o.fade_blacklist)
@@ -574,9 +729,9 @@ void win_on_factor_change(session_t *ps, win *w) {
     win_update_opacity_rule(ps, w);
   if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && ps->o.paint_blacklist)
     w->paint_excluded =
-        c2_match(ps, w, ps->o.paint_blacklist, &w->cache_pblst, NULL);
+        c2_match_cached(ps, w, ps->o.paint_blacklist, &w->cache_pblst, NULL);
   if (w->a.map_state == XCB_MAP_STATE_VIEWABLE && ps->o.unredir_if_possible_blacklist)
-    w->unredir_if_possible_excluded = c2_match(
+    w->unredir_if_possible_excluded = c2_match_cached(
         ps, w, ps->o.unredir_if_possible_blacklist, &w->cache_uipblst, NULL);
   w->reg_ignore_valid = false;
 }
@@ -589,8 +744,8 @@ void calc_win_size(session_t *ps, win *w) {
   w->heightb = w->g.height + w->g.border_width * 2;
   calc_shadow_geometry(ps, w);
   w->flags |= WFLAG_SIZE_CHANGE;
-  // Invalidate the shadow we built
-  free_paint(ps, &w->shadow_paint);
+  // The shadow we built is kept and painted until one of the new size is
+  // ready, see paint_all()
 }
 
 /**
@@ -604,20 +759,23 @@ void calc_shadow_geometry(session_t *ps, win *w) {
 }
 
 /**
- * Update window type.
+ * Update window type from replies of _NET_WM_WINDOW_TYPE and
+ * WM_TRANSIENT_FOR requests.
  */
-void win_upd_wintype(session_t *ps, win *w) {
+static void
+win_set_wintype(session_t *ps, win *w, xcb_get_property_reply_t *r[2]) {
   const wintype_t wtype_old = w->window_type;
 
   // Detect window type here
-  w->window_type = wid_get_prop_wintype(ps, w->client_win);
+  winprop_t prop = win_prop_take(&r[0], XCB_ATOM_ATOM, 32);
+  w->window_type = wintype_from_prop(ps, prop);
+  free_winprop(&prop);
 
   // Conform to EWMH standard, if _NET_WM_WINDOW_TYPE is not present, take
   // override-redirect windows or windows without WM_TRANSIENT_FOR as
   // _NET_WM_WINDOW_TYPE_NORMAL, otherwise as _NET_WM_WINDOW_TYPE_DIALOG.
   if (WINTYPE_UNKNOWN == w->window_type) {
-    if (w->a.override_redirect ||
-        !wid_has_prop(ps, w->client_win, ps->atom_transient))
+    if (w->a.override_redirect || !r[1] || !r[1]->type)
       w->window_type = WINTYPE_NORMAL;
     else
       w->window_type = WINTYPE_DIALOG;
@@ -627,6 +785,16 @@ void win_upd_wintype(session_t *ps, win *w) {
     win_on_wtype_change(ps, w);
 }
 
+/**
+ * Update window type.
+ */
+void win_upd_wintype(session_t *ps, win *w) {
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_WINTYPE, r);
+  win_set_wintype(ps, w, r);
+  win_prop_free(r);
+}
+
 /**
  * Mark a window as the client window of another.
  *
@@ -635,7 +803,11 @@ void win_upd_wintype(session_t *ps, win *w) {
  * @param client window ID of the client window
  */
 void win_mark_client(session_t *ps, win *w, Window client) {
+  if (w->client_win && w->client_win != client)
+    idmap_remove(&ps->client_index, w->client_win, w);
   w->client_win = client;
+  if (!w->destroyed)
+    idmap_set(&ps->client_index, client, w);
 
   // If the window isn't mapped yet, stop here, as the function will be
   // called in map_win()
@@ -648,25 +820,27 @@ void win_mark_client(session_t *ps, win *w, Window client) {
   // Make sure the XSelectInput() requests are sent
   XFlush(ps->dpy);
 
-  win_upd_wintype(ps, w);
+  uint32_t props = WIN_PROP_WINTYPE;
 
   // Get frame widths. The window is in damaged area already.
   if (ps->o.frame_opacity != 1)
-    win_update_frame_extents(ps, w, client);
+    props |= WIN_PROP_FRAME_EXTENTS;
 
   // Get window group
   if (ps->o.track_leader)
-    win_update_leader(ps, w);
+    props |= WIN_PROP_LEADER;
 
   // Get window name and class if we are tracking them
-  if (ps->o.track_wdata) {
-    win_get_name(ps, w);
-    win_get_class(ps, w);
-    win_get_role(ps, w);
-  }
+  if (ps->o.track_wdata)
+    props |= WIN_PROP_NAME | WIN_PROP_CLASS | WIN_PROP_ROLE;
+
+  win_update_props(ps, w, props);
+
+  // Fetch the properties rules look at in one go
+  c2_prop_cache_prefetch(ps, w);
 
   // Update everything related to conditions
-  win_on_factor_change(ps, w);
+  win_on_factor_change(ps, w, C2_DEP_ALL);
 
   // Update window focus state
   win_update_focused(ps, w);
@@ -682,6 +856,7 @@ void win_unmark_client(session_t *ps, win *w) {
   Window client = w->client_win;
 
   w->client_win = None;
+  idmap_remove(&ps->client_index, client, w);
 
   // Recheck event mask
   xcb_change_window_attributes(ps->c, client, XCB_CW_EVENT_MASK,
@@ -726,10 +901,30 @@ void win_recheck_client(session_t *ps, win *w) {
   win_mark_client(ps, w, cw);
 }
 
+win_add_req_t add_win_request(session_t *ps, Window id) {
+  win_add_req_t req = { .id = None };
+
+  // Reject overlay window and already added windows
+  if (id == ps->overlay || find_win(ps, id))
+    return req;
+
+  req.id = id;
+  req.acookie = xcb_get_window_attributes(ps->c, id);
+  req.gcookie = xcb_get_geometry(ps->c, id);
+  // Create Damage for window. We don't know if it's an InputOnly window yet,
+  // the error for that case is picked up and ignored in add_win_finish().
+  req.damage = xcb_generate_id(ps->c);
+  req.dcookie = xcb_damage_create_checked(ps->c, req.damage, id,
+      XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+  return req;
+}
+
 // TODO: probably split into win_new (in win.c) and add_win (in compton.c)
-bool add_win(session_t *ps, Window id, Window prev) {
+bool add_win_finish(session_t *ps, const win_add_req_t *req, Window prev) {
+  const Window id = req->id;
   static const win win_def = {
       .next = NULL,
+      .prev = NULL,
       .prev_trans = NULL,
 
       .id = None,
@@ -744,6 +939,7 @@ bool add_win(session_t *ps, Window id, Window prev) {
       .pixmap_damaged = false,
       .paint = PAINT_INIT,
       .flags = 0,
+      .props_dirty = 0,
       .need_configure = false,
       .queue_configure = {},
       .reg_ignore = NULL,
@@ -770,12 +966,16 @@ bool add_win(session_t *ps, Window id, Window prev) {
       .class_instance = NULL,
       .class_general = NULL,
       .role = NULL,
-      .cache_sblst = NULL,
-      .cache_fblst = NULL,
-      .cache_fcblst = NULL,
-      .cache_ivclst = NULL,
-      .cache_bbblst = NULL,
-      .cache_oparule = NULL,
+      .cache_sblst = C2_RESULT_INIT,
+      .cache_fblst = C2_RESULT_INIT,
+      .cache_fcblst = C2_RESULT_INIT,
+      .cache_ivclst = C2_RESULT_INIT,
+      .cache_bbblst = C2_RESULT_INIT,
+      .cache_oparule = C2_RESULT_INIT,
+      .cache_pblst = C2_RESULT_INIT,
+      .cache_uipblst = C2_RESULT_INIT,
+      .prop_cache = NULL,
+      .ms_result = NULL,
 
       .opacity = 0,
       .opacity_tgt = 0,
@@ -798,7 +998,8 @@ bool add_win(session_t *ps, Window id, Window prev) {
       .shadow_dy = 0,
       .shadow_width = 0,
       .shadow_height = 0,
-      .shadow_paint = PAINT_INIT,
+      .shadow_paint = NULL,
+      .shadow_pending = NULL,
       .prop_shadow = -1,
 
       .dim = false,
@@ -807,10 +1008,33 @@ bool add_win(session_t *ps, Window id, Window prev) {
       .invert_color_force = UNSET,
 
       .blur_background = false,
+      .blur_cache_pict = XCB_NONE,
   };
 
-  // Reject overlay window and already added windows
-  if (id == ps->overlay || find_win(ps, id)) {
+  if (!id)
+    return false;
+
+  // Collect the replies in the order the requests were sent, so nothing
+  // waits on more than one round trip
+  xcb_get_window_attributes_reply_t *a =
+    xcb_get_window_attributes_reply(ps->c, req->acookie, NULL);
+  xcb_get_geometry_reply_t *g = xcb_get_geometry_reply(ps->c, req->gcookie, NULL);
+  xcb_generic_error_t *e = xcb_request_check(ps->c, req->dcookie);
+  xcb_damage_damage_t damage = req->damage;
+  if (e) {
+    damage = None;
+    free(e);
+  }
+
+  if (!a || a->map_state == XCB_MAP_STATE_UNVIEWABLE || !g
+      || (InputOutput == a->_class && !damage)) {
+    // Failed to get window attributes probably means the window is gone
+    // already. Unviewable means the window is already reparented
+    // elsewhere.
+    if (damage)
+      xcb_damage_destroy(ps->c, damage);
+    free(a);
+    free(g);
     return false;
   }
 
@@ -821,50 +1045,19 @@ bool add_win(session_t *ps, Window id, Window prev) {
   printf_dbgf("(%#010lx): %p\n", id, new);
 #endif
 
-  if (!new) {
-    printf_errf("(%#010lx): Failed to allocate memory for the new window.", id);
-    return false;
-  }
-
   *new = win_def;
   pixman_region32_init(&new->bounding_shape);
+  pixman_region32_init(&new->blur_cache_valid);
+  pixman_region32_init(&new->damage_content);
 
-  // Find window insertion point
-  win **p = NULL;
-  if (prev) {
-    for (p = &ps->list; *p; p = &(*p)->next) {
-      if ((*p)->id == prev && !(*p)->destroyed)
-        break;
-    }
-  } else {
-    p = &ps->list;
-  }
+  // Find window insertion point. If `prev` is not found, the window goes
+  // to the bottom of the stack.
+  win *below = prev ? find_win(ps, prev): ps->list;
 
   // Fill structure
   new->id = id;
-
-  xcb_get_window_attributes_cookie_t acookie = xcb_get_window_attributes(ps->c, id);
-  xcb_get_geometry_cookie_t gcookie = xcb_get_geometry(ps->c, id);
-  xcb_get_window_attributes_reply_t *a = xcb_get_window_attributes_reply(ps->c, acookie, NULL);
-  xcb_get_geometry_reply_t *g = xcb_get_geometry_reply(ps->c, gcookie, NULL);
-  if (!a || a->map_state == XCB_MAP_STATE_UNVIEWABLE) {
-    // Failed to get window attributes probably means the window is gone
-    // already. Unviewable means the window is already reparented
-    // elsewhere.
-    free(a);
-    free(g);
-    free(new);
-    return false;
-  }
-
   new->a = *a;
   free(a);
-
-  if (!g) {
-    free(new);
-    return false;
-  }
-
   new->g = *g;
   free(g);
 
@@ -874,22 +1067,16 @@ bool add_win(session_t *ps, Window id, Window prev) {
   new->a.map_state = XCB_MAP_STATE_UNMAPPED;
 
   if (InputOutput == new->a._class) {
-    // Create Damage for window
-    new->damage = xcb_generate_id(ps->c);
-    xcb_generic_error_t *e = xcb_request_check(ps->c,
-      xcb_damage_create_checked(ps->c, new->damage, id, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY));
-    if (e) {
-      free(e);
-      free(new);
-      return false;
-    }
+    new->damage = damage;
     new->pictfmt = x_get_pictform_for_visual(ps, new->a.visual);
+  } else if (damage) {
+    xcb_damage_destroy(ps->c, damage);
   }
 
   calc_win_size(ps, new);
 
-  new->next = *p;
-  *p = new;
+  win_stack_insert(ps, new, below);
+  idmap_set(&ps->win_index, id, new);
   win_update_bounding_shape(ps, new);
 
 #ifdef CONFIG_DBUS
@@ -906,6 +1093,11 @@ bool add_win(session_t *ps, Window id, Window prev) {
   return true;
 }
 
+bool add_win(session_t *ps, Window id, Window prev) {
+  win_add_req_t req = add_win_request(ps, id);
+  return add_win_finish(ps, &req, prev);
+}
+
 /**
  * Update focused state of a window.
  */
@@ -915,6 +1107,8 @@ void win_update_focused(session_t *ps, win *w) {
   }
   else {
     w->focused = win_is_focused_real(ps, w);
+    // Focus may have changed without going through win_on_factor_change()
+    w->cache_fcblst.dirty |= C2_DEP_FOCUS;
 
     // Use wintype_focus, and treat WM windows and override-redirected
     // windows specially
@@ -923,7 +1117,7 @@ void win_update_focused(session_t *ps, win *w) {
         || (ps->o.mark_ovredir_focused &&
             w->id == w->client_win && !w->wmwin)
         || (w->a.map_state == XCB_MAP_STATE_VIEWABLE &&
-            c2_match(ps, w, ps->o.focus_blacklist, &w->cache_fcblst, NULL)))
+            c2_match_cached(ps, w, ps->o.focus_blacklist, &w->cache_fcblst, NULL)))
       w->focused = true;
 
     // If window grouping detection is enabled, mark the window active if
@@ -969,22 +1163,25 @@ static inline void win_set_leader(session_t *ps, win *w, Window nleader) {
     }
 
     // Update everything related to conditions
-    win_on_factor_change(ps, w);
+    win_on_factor_change(ps, w, C2_DEP_LEADER | C2_DEP_FOCUS);
   }
 }
 
 /**
- * Update leader of a window.
+ * Update leader of a window from replies of WM_TRANSIENT_FOR and
+ * WM_CLIENT_LEADER requests.
  */
-void win_update_leader(session_t *ps, win *w) {
+static void
+win_set_leader_prop(session_t *ps, win *w, xcb_get_property_reply_t *r[2]) {
   Window leader = None;
 
-  // Read the leader properties
-  if (ps->o.detect_transient && !leader)
-    leader = wid_get_prop_window(ps, w->client_win, ps->atom_transient);
-
-  if (ps->o.detect_client_leader && !leader)
-    leader = wid_get_prop_window(ps, w->client_win, ps->atom_client_leader);
+  // Read the leader properties, in order of preference
+  for (int i = 0; i < 2 && !leader; i++) {
+    winprop_t prop = win_prop_take(&r[i], XCB_ATOM_WINDOW, 32);
+    if (prop.nitems)
+      leader = *prop.p32;
+    free_winprop(&prop);
+  }
 
   win_set_leader(ps, w, leader);
 
@@ -993,6 +1190,16 @@ void win_update_leader(session_t *ps, win *w) {
 #endif
 }
 
+/**
+ * Update leader of a window.
+ */
+void win_update_leader(session_t *ps, win *w) {
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_LEADER, r);
+  win_set_leader_prop(ps, w, r);
+  win_prop_free(r);
+}
+
 /**
  * Internal function of win_get_leader().
  */
@@ -1020,25 +1227,21 @@ Window win_get_leader_raw(session_t *ps, win *w, int recursions) {
 }
 
 /**
- * Retrieve the <code>WM_CLASS</code> of a window and update its
- * <code>win</code> structure.
+ * Update the <code>WM_CLASS</code> of a window from the reply of a request.
  */
-bool win_get_class(session_t *ps, win *w) {
+static bool
+win_set_class(session_t *ps, win *w, xcb_get_property_reply_t *r[2]) {
   char **strlst = NULL;
   int nstr = 0;
 
-  // Can't do anything if there's no client window
-  if (!w->client_win)
-    return false;
-
   // Free and reset old strings
   free(w->class_instance);
   free(w->class_general);
   w->class_instance = NULL;
   w->class_general = NULL;
 
-  // Retrieve the property string list
-  if (!wid_get_text_prop(ps, w->client_win, ps->atom_class, &strlst, &nstr))
+  // Convert the property to a string list
+  if (!x_text_prop_from_reply(ps, r[0], &strlst, &nstr))
     return false;
 
   // Copy the strings if successful
@@ -1058,6 +1261,22 @@ bool win_get_class(session_t *ps, win *w) {
   return true;
 }
 
+/**
+ * Retrieve the <code>WM_CLASS</code> of a window and update its
+ * <code>win</code> structure.
+ */
+bool win_get_class(session_t *ps, win *w) {
+  // Can't do anything if there's no client window
+  if (!w->client_win)
+    return false;
+
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_CLASS, r);
+  bool ret = win_set_class(ps, w, r);
+  win_prop_free(r);
+  return ret;
+}
+
 
 
 /**
@@ -1094,7 +1313,7 @@ win_on_focus_change(session_t *ps, win *w) {
   }
 
   // Update everything related to conditions
-  win_on_factor_change(ps, w);
+  win_on_factor_change(ps, w, C2_DEP_FOCUS);
 
 #ifdef CONFIG_DBUS
   // Send D-Bus signal
@@ -1198,42 +1417,30 @@ void win_update_bounding_shape(session_t *ps, win *w) {
   if (w->bounding_shaped && ps->o.detect_rounded_corners)
     win_rounded_corners(ps, w);
 
-  // Window shape changed, we should free old wpaint and shadow pict
+  // Window shape changed, we should free old wpaint. The shadow only depends
+  // on the size of the window
   free_paint(ps, &w->paint);
-  free_paint(ps, &w->shadow_paint);
   //printf_errf("(): free out dated pict");
 
-  win_on_factor_change(ps, w);
+  win_on_factor_change(ps, w, C2_DEP_SHAPE);
 }
 
 /**
  * Reread opacity property of a window.
  */
 void win_update_opacity_prop(session_t *ps, win *w) {
-  // get frame opacity first
-  w->has_opacity_prop =
-    wid_get_opacity_prop(ps, w->id, OPAQUE, &w->opacity_prop);
-
-  if (w->has_opacity_prop)
-    // opacity found
-    return;
-
-  if (ps->o.detect_client_opacity && w->client_win && w->id == w->client_win)
-    // checking client opacity not allowed
-    return;
-
-  // get client opacity
-  w->has_opacity_prop =
-    wid_get_opacity_prop(ps, w->client_win, OPAQUE, &w->opacity_prop);
+  xcb_get_property_reply_t *r[2];
+  win_prop_fetch(ps, w, WIN_PROP_OPACITY, r);
+  win_set_opacity_prop(w, r);
+  win_prop_free(r);
 }
 
 /**
- * Retrieve frame extents from a window.
+ * Update frame extents of a window from the reply of a request.
  */
-void
-win_update_frame_extents(session_t *ps, win *w, Window client) {
-  winprop_t prop = wid_get_prop(ps, client, ps->atom_frame_extents,
-    4L, XCB_ATOM_CARDINAL, 32);
+static void
+win_set_frame_extents(session_t *ps, win *w, xcb_get_property_reply_t *r[2]) {
+  winprop_t prop = win_prop_take(&r[0], XCB_ATOM_CARDINAL, 32);
 
   if (prop.nitems == 4) {
     const uint32_t * const extents = prop.c32;
@@ -1261,16 +1468,58 @@ win_update_frame_extents(session_t *ps, win *w, Window client) {
   free_winprop(&prop);
 }
 
+/**
+ * Retrieve frame extents from a window.
+ */
+void
+win_update_frame_extents(session_t *ps, win *w, Window client) {
+  xcb_get_property_reply_t *r[2] = {
+    xcb_get_property_reply(ps->c, xcb_get_property(ps->c, 0, client,
+          ps->atom_frame_extents, XCB_ATOM_CARDINAL, 0, 4), NULL),
+    NULL,
+  };
+  win_set_frame_extents(ps, w, r);
+  win_prop_free(r);
+}
+
 bool win_is_region_ignore_valid(session_t *ps, win *w) {
-  for(win *i = ps->list; w; w = w->next) {
-    if (i == w)
-      break;
+  for (win *i = w->prev; i; i = i->prev) {
     if (!i->reg_ignore_valid)
       return false;
   }
   return true;
 }
 
+void win_stack_insert(session_t *ps, win *w, win *below) {
+  w->next = below;
+  if (below) {
+    w->prev = below->prev;
+    below->prev = w;
+  } else {
+    w->prev = ps->list_tail;
+    ps->list_tail = w;
+  }
+
+  if (w->prev)
+    w->prev->next = w;
+  else
+    ps->list = w;
+}
+
+void win_stack_remove(session_t *ps, win *w) {
+  if (w->prev)
+    w->prev->next = w->next;
+  else
+    ps->list = w->next;
+
+  if (w->next)
+    w->next->prev = w->prev;
+  else
+    ps->list_tail = w->prev;
+
+  w->next = w->prev = NULL;
+}
+
 /**
  * Stop listening for events on a particular window.
  */
@@ -1321,3 +1570,129 @@ win_check_fade_finished(session_t *ps, win **_w) {
     win_set_fade_callback(ps, _w, NULL, true);
   }
 }
+
+/// Requests sent to refresh properties of a window.
+typedef struct {
+  win *w;
+  /// Mask of WIN_PROP_* being refreshed.
+  uint32_t props;
+  xcb_get_property_cookie_t cookies[WIN_PROP_NUM][2];
+} win_prop_req_t;
+
+static void
+win_props_request(session_t *ps, win_prop_req_t *req) {
+  for (int i = 0; i < WIN_PROP_NUM; i++)
+    if (req->props & (1u << i))
+      win_prop_request(ps, req->w, 1u << i, req->cookies[i]);
+}
+
+/**
+ * Collect the replies of requests sent by win_props_request(), and update
+ * the window with them.
+ *
+ * @return mask of C2_DEP_* of window data that changed
+ */
+static uint32_t
+win_props_finish(session_t *ps, win_prop_req_t *req) {
+  win *w = req->w;
+  uint32_t changed = 0;
+
+  for (int i = 0; i < WIN_PROP_NUM; i++) {
+    if (!(req->props & (1u << i)))
+      continue;
+
+    xcb_get_property_reply_t *r[2];
+    win_prop_collect(ps, req->cookies[i], r);
+    switch (1u << i) {
+      case WIN_PROP_WINTYPE:        win_set_wintype(ps, w, r);        break;
+      case WIN_PROP_FRAME_EXTENTS:  win_set_frame_extents(ps, w, r);  break;
+      case WIN_PROP_LEADER:         win_set_leader_prop(ps, w, r);    break;
+      case WIN_PROP_NAME:
+        if (1 == win_set_name(ps, w, r))
+          changed |= C2_DEP_NAME;
+        break;
+      case WIN_PROP_CLASS:
+        win_set_class(ps, w, r);
+        changed |= C2_DEP_CLASS;
+        break;
+      case WIN_PROP_ROLE:
+        if (1 == win_set_role(ps, w, r))
+          changed |= C2_DEP_ROLE;
+        break;
+      case WIN_PROP_OPACITY:        win_set_opacity_prop(w, r);       break;
+      case WIN_PROP_SHADOW:         win_set_prop_shadow(w, r);        break;
+      default:                      assert(0);                        break;
+    }
+    win_prop_free(r);
+  }
+
+  return changed;
+}
+
+/**
+ * Refresh properties of a window, sending all requests before waiting for
+ * any of the replies.
+ *
+ * @param props mask of WIN_PROP_* to refresh
+ * @return mask of C2_DEP_* of window data that changed
+ */
+uint32_t win_update_props(session_t *ps, win *w, uint32_t props) {
+  win_prop_req_t req = { .w = w, .props = props };
+  win_props_request(ps, &req);
+  return win_props_finish(ps, &req);
+}
+
+/**
+ * Mark properties of a window to be refreshed before the next paint.
+ *
+ * @param props mask of WIN_PROP_* that changed
+ */
+void win_mark_props_dirty(session_t *ps, win *w, uint32_t props) {
+  w->props_dirty |= props;
+  ps->win_props_dirty = true;
+}
+
+/**
+ * Refresh the properties of all windows marked by win_mark_props_dirty().
+ *
+ * Properties are refreshed once no matter how many times they changed, and
+ * the requests for all windows are sent before waiting for any reply.
+ */
+void win_refresh_dirty_props(session_t *ps) {
+  if (!ps->win_props_dirty)
+    return;
+  ps->win_props_dirty = false;
+
+  int n = 0;
+  for (win *w = ps->list; w; w = w->next)
+    if (w->props_dirty && !w->destroyed)
+      n++;
+
+  auto reqs = ccalloc(n, win_prop_req_t);
+  n = 0;
+  for (win *w = ps->list; w; w = w->next) {
+    if (w->props_dirty && !w->destroyed) {
+      reqs[n] = (win_prop_req_t) { .w = w, .props = w->props_dirty };
+      win_props_request(ps, &reqs[n++]);
+    }
+    w->props_dirty = 0;
+  }
+
+  for (int i = 0; i < n; i++) {
+    win *w = reqs[i].w;
+    const long prop_shadow_old = w->prop_shadow;
+    const uint32_t changed = win_props_finish(ps, &reqs[i]);
+
+    // If frame extents change, the window needs repaint
+    if (reqs[i].props & WIN_PROP_FRAME_EXTENTS)
+      add_damage_from_win(ps, w);
+    if (reqs[i].props & WIN_PROP_OPACITY)
+      w->flags |= WFLAG_OPCT_CHANGE;
+    if (w->prop_shadow != prop_shadow_old)
+      win_determine_shadow(ps, w);
+    if (changed)
+      win_on_factor_change(ps, w, changed);
+  }
+
+  free(reqs);
+}
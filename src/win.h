@@ -22,6 +22,9 @@ typedef struct session session_t;
 typedef struct _glx_texture glx_texture_t;
 
 #ifdef CONFIG_OPENGL
+/// @brief Maximum downsampling levels of the dual Kawase blur.
+#define GLX_KAWASE_MAX_LEVELS 5
+
 // FIXME this type should be in opengl.h
 //       it is very unideal for it to be here
 typedef struct {
@@ -29,10 +32,20 @@ typedef struct {
   GLuint fbo;
   /// Textures used for blurring.
   GLuint textures[2];
+  /// Downsampled textures used by the dual Kawase blur, each half the size
+  /// of the one before, textures[0] being the first.
+  GLuint kawase_textures[GLX_KAWASE_MAX_LEVELS];
   /// Width of the textures.
   int width;
   /// Height of the textures.
   int height;
+  /// Texture holding the blurred background of the window, kept across
+  /// frames.
+  GLuint result;
+  /// Width of the result texture.
+  int result_width;
+  /// Height of the result texture.
+  int result_height;
 } glx_blur_cache_t;
 #endif
 
@@ -72,11 +85,27 @@ typedef enum {
  * Local: the origin is the top left corner of the window, including border.
  */
 
+/// Window properties refreshed by win_update_props(). Used as bits of a
+/// mask, in the order they are refreshed.
+enum {
+  WIN_PROP_WINTYPE       = 1 << 0,
+  WIN_PROP_FRAME_EXTENTS = 1 << 1,
+  WIN_PROP_LEADER        = 1 << 2,
+  WIN_PROP_NAME          = 1 << 3,
+  WIN_PROP_CLASS         = 1 << 4,
+  WIN_PROP_ROLE          = 1 << 5,
+  WIN_PROP_OPACITY       = 1 << 6,
+  WIN_PROP_SHADOW        = 1 << 7,
+};
+#define WIN_PROP_NUM 8
+
 /// Structure representing a top-level window compton manages.
 typedef struct win win;
 struct win {
   /// Pointer to the next lower window in window stack.
   win *next;
+  /// Pointer to the next higher window in window stack.
+  win *prev;
   /// Pointer to the next higher window to paint.
   win *prev_trans;
 
@@ -100,6 +129,10 @@ struct win {
   XSyncFence fence;
   /// Whether the window was damaged after last paint.
   bool pixmap_damaged;
+#ifdef DEBUG_TIMING
+  /// When the window was last mapped, cleared once it's painted.
+  struct timespec map_time;
+#endif
   /// Damage of the window.
   xcb_damage_damage_t damage;
   /// Paint info of the window.
@@ -110,6 +143,8 @@ struct win {
   region_t bounding_shape;
   /// Window flags. Definitions above.
   int_fast16_t flags;
+  /// Mask of WIN_PROP_* of properties to refresh before the next paint.
+  uint32_t props_dirty;
   /// Whether there's a pending <code>ConfigureNotify</code> happening
   /// when the window is unmapped.
   bool need_configure;
@@ -170,14 +205,18 @@ struct win {
   char *class_general;
   /// <code>WM_WINDOW_ROLE</code> value of the window.
   char *role;
-  const c2_lptr_t *cache_sblst;
-  const c2_lptr_t *cache_fblst;
-  const c2_lptr_t *cache_fcblst;
-  const c2_lptr_t *cache_ivclst;
-  const c2_lptr_t *cache_bbblst;
-  const c2_lptr_t *cache_oparule;
-  const c2_lptr_t *cache_pblst;
-  const c2_lptr_t *cache_uipblst;
+  c2_result_t cache_sblst;
+  c2_result_t cache_fblst;
+  c2_result_t cache_fcblst;
+  c2_result_t cache_ivclst;
+  c2_result_t cache_bbblst;
+  c2_result_t cache_oparule;
+  c2_result_t cache_pblst;
+  c2_result_t cache_uipblst;
+  /// Cached raw window properties used by rules.
+  struct c2_prop *prop_cache;
+  /// Results of the multi-pattern matcher of string conditions.
+  struct c2_ms_result *ms_result;
 
   // Opacity-related members
   /// Current window opacity.
@@ -228,8 +267,11 @@ struct win {
   int shadow_width;
   /// Height of shadow. Affected by window size and commandline argument.
   int shadow_height;
-  /// Picture to render shadow. Affected by window size.
-  paint_t shadow_paint;
+  /// Shadow to render, shared with windows of the same size. Affected by
+  /// window size.
+  shadow_t *shadow_paint;
+  /// Shadow of the current size of the window, while it's being built.
+  shadow_t *shadow_pending;
   /// The value of _COMPTON_SHADOW attribute of the window. Below 0 for
   /// none.
   long prop_shadow;
@@ -250,6 +292,19 @@ struct win {
   bool blur_background;
   /// Background state on last paint.
   bool blur_background_last;
+  /// Blurred background kept across frames, with the XRender backend.
+  xcb_render_picture_t blur_cache_pict;
+  /// Part of the kept blurred background which is up to date, in window
+  /// local coordinates.
+  region_t blur_cache_valid;
+  /// Position, size and blur strength the kept blurred background was made
+  /// with.
+  int blur_cache_x, blur_cache_y;
+  int blur_cache_width, blur_cache_height;
+  double blur_cache_factor;
+  /// Damage from the content of the window since the last paint, which
+  /// changes the background of the windows above it.
+  region_t damage_content;
 
 #ifdef CONFIG_OPENGL
   /// Textures and FBO background blur use.
@@ -274,7 +329,7 @@ void win_determine_invert_color(session_t *ps, win *w);
 void win_set_blur_background(session_t *ps, win *w, bool blur_background_new);
 void win_determine_blur_background(session_t *ps, win *w);
 void win_on_wtype_change(session_t *ps, win *w);
-void win_on_factor_change(session_t *ps, win *w);
+void win_on_factor_change(session_t *ps, win *w, uint32_t changed);
 void calc_win_size(session_t *ps, win *w);
 void calc_shadow_geometry(session_t *ps, win *w);
 void win_upd_wintype(session_t *ps, win *w);
@@ -293,6 +348,9 @@ void win_update_opacity_prop(session_t *ps, win *w);
  * Update leader of a window.
  */
 void win_update_leader(session_t *ps, win *w);
+uint32_t win_update_props(session_t *ps, win *w, uint32_t props);
+void win_mark_props_dirty(session_t *ps, win *w, uint32_t props);
+void win_refresh_dirty_props(session_t *ps);
 /**
  * Update focused state of a window.
  */
@@ -329,6 +387,29 @@ void
 win_update_frame_extents(session_t *ps, win *w, Window client);
 bool add_win(session_t *ps, Window id, Window prev);
 
+/// Requests sent to the X server to adopt a new window. Separated from
+/// add_win_finish() so requests for many windows can be sent before waiting
+/// on any of the replies.
+typedef struct win_add_req {
+  /// ID of the window, None if the window is rejected
+  Window id;
+  xcb_get_window_attributes_cookie_t acookie;
+  xcb_get_geometry_cookie_t gcookie;
+  xcb_damage_damage_t damage;
+  xcb_void_cookie_t dcookie;
+} win_add_req_t;
+
+win_add_req_t add_win_request(session_t *ps, Window id);
+/// Wait for the replies of an add_win_request(), and add the window above
+/// `prev` if it's still there.
+bool add_win_finish(session_t *ps, const win_add_req_t *req, Window prev);
+
+/// Link a window into the window stack, directly above `below`. Puts it at
+/// the bottom of the stack if `below` is NULL.
+void win_stack_insert(session_t *ps, win *w, win *below);
+/// Unlink a window from the window stack.
+void win_stack_remove(session_t *ps, win *w);
+
 /**
  * Set fade callback of a window, and possibly execute the previous
  * callback.
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "log.h"
+#include "worker.h"
+
+#define WORKER_MAX_THREADS 4
+
+struct worker_job {
+  worker_fn work, done;
+  void *data;
+  struct worker_job *next;
+};
+
+/// A FIFO of jobs
+struct worker_queue {
+  struct worker_job *head, **tail;
+};
+
+struct worker_pool {
+  struct ev_loop *loop;
+  /// Signalled when jobs are finished
+  ev_async finished;
+
+  pthread_mutex_t lock;
+  /// Signalled when jobs are queued, or the pool is shutting down
+  pthread_cond_t cond;
+  struct worker_queue pending;
+  struct worker_queue done;
+  bool quit;
+
+  int nthreads;
+  pthread_t threads[WORKER_MAX_THREADS];
+};
+
+static inline void
+worker_queue_init(struct worker_queue *q) {
+  q->head = NULL;
+  q->tail = &q->head;
+}
+
+static inline void
+worker_queue_push(struct worker_queue *q, struct worker_job *job) {
+  job->next = NULL;
+  *q->tail = job;
+  q->tail = &job->next;
+}
+
+static inline struct worker_job *
+worker_queue_pop(struct worker_queue *q) {
+  struct worker_job *job = q->head;
+  if (job && !(q->head = job->next))
+    q->tail = &q->head;
+  return job;
+}
+
+static void *
+worker_main(void *arg) {
+  struct worker_pool *pool = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    struct worker_job *job = worker_queue_pop(&pool->pending);
+    if (!job) {
+      if (pool->quit)
+        break;
+      pthread_cond_wait(&pool->cond, &pool->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    job->work(job->data);
+    pthread_mutex_lock(&pool->lock);
+
+    worker_queue_push(&pool->done, job);
+    ev_async_send(pool->loop, &pool->finished);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/// Run the done functions of finished jobs
+static void
+worker_run_done(struct worker_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  struct worker_job *jobs = pool->done.head;
+  worker_queue_init(&pool->done);
+  pthread_mutex_unlock(&pool->lock);
+
+  while (jobs) {
+    struct worker_job *next = jobs->next;
+    if (jobs->done)
+      jobs->done(jobs->data);
+    free(jobs);
+    jobs = next;
+  }
+}
+
+static void
+worker_finished_callback(EV_P_ ev_async *w, int revents) {
+  worker_run_done((struct worker_pool *)
+      ((char *) w - offsetof(struct worker_pool, finished)));
+}
+
+struct worker_pool *
+worker_pool_new(struct ev_loop *loop) {
+  auto pool = ccalloc(1, struct worker_pool);
+  pool->loop = loop;
+  worker_queue_init(&pool->pending);
+  worker_queue_init(&pool->done);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  ev_async_init(&pool->finished, worker_finished_callback);
+  ev_async_start(loop, &pool->finished);
+
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int nthreads = ncpus > 1 ? ncpus - 1 : 1;
+  if (nthreads > WORKER_MAX_THREADS)
+    nthreads = WORKER_MAX_THREADS;
+
+  for (; pool->nthreads < nthreads; pool->nthreads++) {
+    if (pthread_create(&pool->threads[pool->nthreads], NULL, worker_main,
+          pool)) {
+      printf_errf("(): Failed to start worker thread %d", pool->nthreads);
+      break;
+    }
+  }
+
+  return pool;
+}
+
+void
+worker_pool_free(struct worker_pool *pool) {
+  if (!pool)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  // Workers drain the queue before quitting
+  for (int i = 0; i < pool->nthreads; i++)
+    pthread_join(pool->threads[i], NULL);
+  worker_run_done(pool);
+
+  ev_async_stop(pool->loop, &pool->finished);
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+void
+worker_submit(struct worker_pool *pool, worker_fn work, worker_fn done,
+    void *data) {
+  auto job = cmalloc(struct worker_job);
+  job->work = work;
+  job->done = done;
+  job->data = data;
+
+  // Without threads the work is done right away, but the done function
+  // still runs from the loop, the caller may not be ready for it yet
+  if (!pool->nthreads) {
+    work(data);
+    pthread_mutex_lock(&pool->lock);
+    worker_queue_push(&pool->done, job);
+    pthread_mutex_unlock(&pool->lock);
+    ev_async_send(pool->loop, &pool->finished);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  worker_queue_push(&pool->pending, job);
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+#include <stdbool.h>
+#include <ev.h>
+
+/// A small pool of threads, running CPU bound jobs off the event loop.
+///
+/// Each job has a work function, run on one of the worker threads, and a done
+/// function, run on the event loop thread after the work has finished. Done
+/// functions are called in the order the work finishes. Work functions must
+/// not touch anything the event loop thread might be modifying, X requests
+/// and session state should be left to the done function.
+///
+/// If no thread could be started, jobs are run synchronously when submitted.
+struct worker_pool;
+
+typedef void (*worker_fn)(void *data);
+
+struct worker_pool *worker_pool_new(struct ev_loop *loop);
+
+/// Finish all submitted jobs, running their done functions, and free the pool.
+void worker_pool_free(struct worker_pool *pool);
+
+/// Submit a job.
+///
+/// @param work function run on a worker thread, or right away if none could
+///             be started
+/// @param done function run on the event loop thread afterwards, may be NULL
+void worker_submit(struct worker_pool *pool, worker_fn work, worker_fn done,
+    void *data);
@@ -31,9 +31,22 @@
 winprop_t
 wid_get_prop_adv(const session_t *ps, xcb_window_t w, xcb_atom_t atom, long offset,
     long length, xcb_atom_t rtype, int rformat) {
-  xcb_get_property_reply_t *r = xcb_get_property_reply(ps->c,
-    xcb_get_property(ps->c, 0, w, atom, rtype, offset, length), NULL);
+  return x_prop_from_reply(xcb_get_property_reply(ps->c,
+    xcb_get_property(ps->c, 0, w, atom, rtype, offset, length), NULL),
+    rtype, rformat);
+}
 
+/**
+ * Make a <code>winprop_t</code> out of the reply of a property request.
+ *
+ * @param r the reply, owned by the returned structure. May be NULL.
+ * @param rtype atom of the requested type
+ * @param rformat requested format
+ * @return a <code>winprop_t</code> structure containing the attribute
+ *    and number of items. A blank one on failure.
+ */
+winprop_t
+x_prop_from_reply(xcb_get_property_reply_t *r, xcb_atom_t rtype, int rformat) {
   if (r && xcb_get_property_value_length(r) &&
       (rtype == XCB_ATOM_ANY || r->type == rtype) &&
       (!rformat || r->format == rformat) &&
@@ -103,6 +116,38 @@ bool wid_get_text_prop(session_t *ps, Window wid, Atom prop,
   return true;
 }
 
+/**
+ * Convert the reply of a text property request to a list of strings, as
+ * wid_get_text_prop() does.
+ *
+ * @param r the reply, not freed. May be NULL.
+ */
+bool x_text_prop_from_reply(session_t *ps, const xcb_get_property_reply_t *r,
+    char ***pstrlst, int *pnstr) {
+  if (!r || !r->type || !xcb_get_property_value_length(r)
+      || (r->format != 8 && r->format != 16 && r->format != 32))
+    return false;
+
+  XTextProperty text_prop = {
+    .value = xcb_get_property_value(r),
+    .encoding = r->type,
+    .format = r->format,
+    .nitems = xcb_get_property_value_length(r) / (r->format / 8),
+  };
+
+  if (Success !=
+      XmbTextPropertyToTextList(ps->dpy, &text_prop, pstrlst, pnstr)
+      || !*pnstr) {
+    *pnstr = 0;
+    if (*pstrlst)
+      XFreeStringList(*pstrlst);
+    *pstrlst = NULL;
+    return false;
+  }
+
+  return true;
+}
+
 static inline void x_get_server_pictfmts(session_t *ps) {
   if (ps->pictfmts)
     return;
@@ -69,6 +69,9 @@ winprop_t
 wid_get_prop_adv(const session_t *ps, xcb_window_t w, xcb_atom_t atom, long offset,
     long length, xcb_atom_t rtype, int rformat);
 
+winprop_t
+x_prop_from_reply(xcb_get_property_reply_t *r, xcb_atom_t rtype, int rformat);
+
 /**
  * Wrapper of wid_get_prop_adv().
  */
@@ -92,6 +95,18 @@ wid_get_prop_window(session_t *ps, Window wid, Atom aprop);
 bool wid_get_text_prop(session_t *ps, Window wid, Atom prop,
     char ***pstrlst, int *pnstr);
 
+/**
+ * Request a text property of a window, to be converted with
+ * x_text_prop_from_reply().
+ */
+static inline xcb_get_property_cookie_t
+x_request_text_prop(xcb_connection_t *c, xcb_window_t wid, xcb_atom_t prop) {
+  return xcb_get_property(c, 0, wid, prop, XCB_ATOM_ANY, 0, UINT32_MAX / 4);
+}
+
+bool x_text_prop_from_reply(session_t *ps, const xcb_get_property_reply_t *r,
+    char ***pstrlst, int *pnstr);
+
 xcb_render_pictforminfo_t *x_get_pictform_for_visual(session_t *, xcb_visualid_t);
 
 xcb_render_picture_t x_create_picture_with_pictfmt_and_pixmap(